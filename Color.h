@@ -10,6 +10,12 @@ class Color : public Vector3 {
         Color(Vector3 vec): Vector3(vec) {}
 };
 
+inline float luminance(const Color& c)
+{
+    // Rec. 709 weights for linear RGB.
+    return 0.2126f * c.x() + 0.7152f * c.y() + 0.0722f * c.z();
+}
+
 inline void linear_to_gamma(float& linearComponent)
 {
     if (linearComponent > 0){
@@ -19,7 +25,7 @@ inline void linear_to_gamma(float& linearComponent)
     linearComponent = 0;
 }
 
-void write_color(std::ostream& out, const Color& pixel_color) {
+void color_to_bytes(const Color& pixel_color, uint8_t* rgb) {
     float r = pixel_color.x();
     float g = pixel_color.y();
     float b = pixel_color.z();
@@ -30,12 +36,17 @@ void write_color(std::ostream& out, const Color& pixel_color) {
 
     // Translate the [0,1] component values to the byte range [0,255].
     static const Interval intensity(0.000, 0.999);
-    uint8_t rbyte = int(255 * intensity.clamp(r));
-    uint8_t gbyte = int(255 * intensity.clamp(g));
-    uint8_t bbyte = int(255 * intensity.clamp(b));
+    rgb[0] = int(255 * intensity.clamp(r));
+    rgb[1] = int(255 * intensity.clamp(g));
+    rgb[2] = int(255 * intensity.clamp(b));
+}
+
+void write_color(std::ostream& out, const Color& pixel_color) {
+    uint8_t rgb[3];
+    color_to_bytes(pixel_color, rgb);
 
     // Write out the pixel color components.
-    out << +rbyte << ' ' << +gbyte << ' ' << +bbyte << '\n';
+    out << +rgb[0] << ' ' << +rgb[1] << ' ' << +rgb[2] << '\n';
 }
 
 
@@ -82,6 +82,29 @@ public:
             return y.size() > z.size() ? 1 : 2;
     }
 
+    float surface_area() const
+    {
+        float dx = x.size(), dy = y.size(), dz = z.size();
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    static AABB lerp(const AABB& a, const AABB& b, float t)
+    {
+        // The box whose faces move linearly from a (t = 0) to b (t = 1). Both are padded
+        // already, so the result is too.
+        AABB box;
+        box.x = Interval(a.x.min + t * (b.x.min - a.x.min), a.x.max + t * (b.x.max - a.x.max));
+        box.y = Interval(a.y.min + t * (b.y.min - a.y.min), a.y.max + t * (b.y.max - a.y.max));
+        box.z = Interval(a.z.min + t * (b.z.min - a.z.min), a.z.max + t * (b.z.max - a.z.max));
+        return box;
+    }
+
+    bool operator==(const AABB& other) const
+    {
+        return x.min == other.x.min && x.max == other.x.max && y.min == other.y.min &&
+               y.max == other.y.max && z.min == other.z.min && z.max == other.z.max;
+    }
+
     static const AABB empty, universe;
 
     private:
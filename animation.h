@@ -0,0 +1,183 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "bvh_cache.h"
+#include "camera.h"
+#include "denoise.h"
+#include "hittable.h"
+#include "hittableList.h"
+#include "image_io.h"
+#include "transform.h"
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+class AnimatedObject : public Hittable {
+    // An object placed by a rigid transform that changes from frame to frame. Rays are taken
+    // into the object's space at every intersection, like Translate and RotateX/Y/Z, so moving
+    // it only changes its bounds and the tree around it can be refit instead of rebuilt.
+    public:
+        AnimatedObject(shared_ptr<Hittable> object) : object(object), bbox(object->bounding_box()) {}
+
+        void set_transform(const Transform& transform) {
+            xf = transform;
+            bbox = xf.bounds(object->bounding_box());
+        }
+
+        const Transform& transform() const { return xf; }
+
+        AABB bounding_box() const override { return bbox; }
+
+        AABB bounding_box_at(float time) const override { return xf.bounds(object->bounding_box_at(time)); }
+
+        bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
+            if (!object->hit(to_object_space(r), rayT, rec))
+                return false;
+            rec.p = xf.point(rec.p);
+            rec.normal = xf.vector(rec.normal);
+            return true;
+        }
+
+        bool occluded(const Ray& r, Interval rayT) const override {
+            return object->occluded(to_object_space(r), rayT);
+        }
+
+    private:
+        shared_ptr<Hittable> object;
+        Transform xf;
+        AABB bbox;
+
+        Ray to_object_space(const Ray& r) const {
+            return Ray(xf.inverse_point(r.origin()), xf.inverse_vector(r.direction()), r.time());
+        }
+};
+
+class FrameStats {
+    public:
+        int frame;
+        bool rebuilt;               // A tree was built this frame rather than only refit
+        double buildSeconds;        // Building or refitting the trees
+        double renderSeconds;
+        double writeWaitSeconds;    // Waiting for the previous frame's image to be written
+        float treeCost;             // Summed node area over root area, relative to the last build
+};
+
+class AnimationSequence {
+    // Renders the frames of a world in which only the camera and the objects added with
+    // animate() move. The static objects' BVH is built once, as Camera::render() would. The
+    // animated objects get a tree of their own that is refit to their new transforms every
+    // frame, and rebuilt only when refitting has made it rebuildThreshold times costlier than
+    // when it was built. Each frame's image is written on a background thread while the next
+    // one renders. Frames are plain images: AOV outputs and heatmaps are for single renders.
+    public:
+        // Largest growth of the animated tree's summed node area (relative to its root's) that
+        // is refit rather than rebuilt.
+        float rebuildThreshold = 1.5f;
+
+        AnimationSequence(const HittableList& staticWorld) : staticWorld(staticWorld) {}
+
+        shared_ptr<AnimatedObject> animate(shared_ptr<Hittable> object) {
+            shared_ptr<AnimatedObject> animated = make_shared<AnimatedObject>(object);
+            animatedList.add(animated);
+            return animated;
+        }
+
+        // Renders frames [0, frameCount) to filename with the frame number before its
+        // extension, calling setup(frame, camera) first to move the camera and set the animated
+        // objects' transforms for each.
+        std::vector<FrameStats> render(Camera& camera, const std::string& filename, int frameCount,
+                                       const std::function<void(int, Camera&)>& setup) {
+            std::vector<FrameStats> frames;
+            std::thread writer;
+            for (int frame = 0; frame < frameCount; frame++) {
+                TRACE_SCOPE("frame", "render", "frame", frame);
+                setup(frame, camera);
+                FrameStats stats = { frame, false, 0, 0, 0, 1 };
+
+                auto start = std::chrono::steady_clock::now();
+                shared_ptr<Hittable> world = update_world(camera, stats);
+                stats.buildSeconds = seconds_since(start);
+
+                start = std::chrono::steady_clock::now();
+                std::vector<Color> pixels;
+                AOVBuffers aovs;
+                camera.render_pass(*world, pixels, camera.samplesPerPixel, camera.denoise ? &aovs : nullptr);
+                float scale = 1.0f / camera.samplesPerPixel;
+                if (camera.denoise) {
+                    DenoiseSettings settings = camera.denoiseSettings;
+                    if (settings.threads == 0)
+                        settings.threads = camera.threadCount;
+                    pixels = Denoiser(camera.imageWidth, camera.image_height(), settings).denoise(pixels, aovs, camera.samplesPerPixel);
+                    scale = 1;
+                }
+                stats.renderSeconds = seconds_since(start);
+
+                start = std::chrono::steady_clock::now();
+                if (writer.joinable())
+                    writer.join();
+                stats.writeWaitSeconds = seconds_since(start);
+                writer = std::thread([name = frame_filename(filename, frame), pixels = std::move(pixels),
+                                      width = camera.imageWidth, height = camera.image_height(), scale] {
+                    TRACE_SCOPE("write image", "io");
+                    write_ppm(name, pixels, width, height, scale);
+                });
+
+                std::clog << "Frame " << frame << ": BVH " << (stats.rebuilt ? "build " : "refit ") << stats.buildSeconds * 1000
+                          << " ms (tree cost " << stats.treeCost << "), render " << stats.renderSeconds << " s" << std::endl;
+                frames.push_back(stats);
+            }
+            if (writer.joinable())
+                writer.join();
+            return frames;
+        }
+
+        static std::string frame_filename(const std::string& filename, int frame) {
+            std::ostringstream number;
+            number << std::setw(4) << std::setfill('0') << frame;
+            return insert_suffix(filename, number.str());
+        }
+
+    private:
+        HittableList staticWorld;
+        HittableList animatedList;
+        shared_ptr<Hittable> staticTree;
+        shared_ptr<BVHNode> animatedTree;
+        float builtCost = 0;        // Summed node area over root area of animatedTree when built
+
+        shared_ptr<Hittable> update_world(const Camera& camera, FrameStats& stats) {
+            if (!staticTree && !staticWorld.objs.empty()) {
+                staticTree = build_bvh(staticWorld, camera.bvhCacheDir, camera.bakeTransforms, camera.timeSplitBVH);
+                stats.rebuilt = true;
+            }
+            if (animatedList.objs.empty())
+                return staticTree ? staticTree : make_shared<HittableList>();
+
+            if (animatedTree) {
+                TRACE_SCOPE("bvh refit", "bvh");
+                stats.treeCost = animatedTree->refit() / animatedTree->bounding_box().surface_area() / builtCost;
+            }
+            if (!animatedTree || !(stats.treeCost <= rebuildThreshold)) {
+                TRACE_SCOPE("bvh build", "bvh");
+                animatedTree = make_shared<BVHNode>(animatedList);
+                builtCost = animatedTree->refit() / animatedTree->bounding_box().surface_area();
+                stats.rebuilt = true;
+                stats.treeCost = 1;
+            }
+            if (!staticTree)
+                return animatedTree;
+            return make_shared<BVHNode>(staticTree, animatedTree, AABB(staticTree->bounding_box(), animatedTree->bounding_box()));
+        }
+
+        static double seconds_since(std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+};
+
+#endif
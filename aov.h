@@ -0,0 +1,101 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include "common.h"
+
+#include <string>
+#include <vector>
+
+// Auxiliary output variables, gathered from each camera ray's first hit in the same pass as the
+// image.
+
+enum AOVTYPE {
+    AOV_ALBEDO = 1 << 0,
+    AOV_NORMAL = 1 << 1,
+    AOV_DEPTH = 1 << 2,
+    AOV_OBJECT_ID = 1 << 3,
+    AOV_MATERIAL_ID = 1 << 4,
+    AOV_ALL = (1 << 5) - 1,
+};
+
+class AOVSample {
+    public:
+        Color albedo;               // Material albedo at the first hit; the background on a miss
+        Vector3 normal;             // Shading normal facing the ray; zero on a miss
+        float depth = 0;            // Distance from the ray origin; zero on a miss
+        uint32_t objectId = 0;      // Zero on a miss
+        uint32_t materialId = 0;
+};
+
+class AOVBuffers {
+    // Per-pixel sums over samples, like the image accumulation buffer. Ids cannot be averaged,
+    // so they keep the first sample's values. The luminance squares let the denoiser estimate
+    // each pixel's variance.
+    public:
+        int width = 0;
+        int height = 0;
+        std::vector<Color> albedo;
+        std::vector<Vector3> normal;
+        std::vector<float> depth;
+        std::vector<uint32_t> objectId;
+        std::vector<uint32_t> materialId;
+        std::vector<float> luminanceSquared;
+
+        void resize(int w, int h) {
+            // Keeps existing sums when the size is unchanged, so passes can accumulate.
+            if (w == width && h == height)
+                return;
+            width = w;
+            height = h;
+            size_t count = size_t(w) * h;
+            albedo.assign(count, Color(0, 0, 0));
+            normal.assign(count, Vector3(0, 0, 0));
+            depth.assign(count, 0.0f);
+            objectId.assign(count, unset);
+            materialId.assign(count, unset);
+            luminanceSquared.assign(count, 0.0f);
+        }
+
+        void add(size_t n, const AOVSample& sample, const Color& color) {
+            albedo[n] += sample.albedo;
+            normal[n] += sample.normal;
+            depth[n] += sample.depth;
+            if (objectId[n] == unset) {
+                objectId[n] = sample.objectId;
+                materialId[n] = sample.materialId;
+            }
+            float l = luminance(color);
+            luminanceSquared[n] += l * l;
+        }
+
+    private:
+        static constexpr uint32_t unset = 0xffffffffu;
+};
+
+inline unsigned parse_aov_list(const std::string& list)
+{
+    // Parses a comma-separated list of albedo, normal, depth, object, material or all. Returns 0
+    // after reporting an unknown name.
+    unsigned mask = 0;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string name = list.substr(start, end - start);
+        if (name == "albedo") mask |= AOV_ALBEDO;
+        else if (name == "normal") mask |= AOV_NORMAL;
+        else if (name == "depth") mask |= AOV_DEPTH;
+        else if (name == "object") mask |= AOV_OBJECT_ID;
+        else if (name == "material") mask |= AOV_MATERIAL_ID;
+        else if (name == "all") mask |= AOV_ALL;
+        else {
+            std::cerr << "ERROR: Unknown AOV '" << name << "'.\n";
+            return 0;
+        }
+        start = end + 1;
+    }
+    return mask;
+}
+
+#endif
@@ -0,0 +1,478 @@
+// Kernel microbenchmarks.
+//
+// Times primitive intersection, AABB slab tests, BVH traversal over synthetic scenes of growing
+// size (random rays, closest-hit against any-hit shadow rays, and coherent camera rays singly
+// and as 8x8 packets), material scattering, texture lookups and Perlin noise, and prints the
+// results as JSON so runs from different versions can be compared.
+//
+// Usage: microbench [--filter <substring>] [--min-time <seconds>] [--out <file.json>]
+
+#include "../common.h"
+
+#include "../bvh.h"
+#include "../dynamic_bvh.h"
+#include "../hittableList.h"
+#include "../material.h"
+#include "../quad.h"
+#include "../sphere.h"
+#include "../texture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+class BenchResult {
+    public:
+        std::string name;
+        long iterations;
+        double nsPerOp;         // Fastest repetition
+        double nsPerOpMedian;
+};
+
+class BenchRunner {
+    public:
+        std::string filter;
+        double minTime = 0.1;
+        int repetitions = 5;
+        std::vector<BenchResult> results;
+
+        bool selected(const std::string& name) const {
+            return filter.empty() || name.find(filter) != std::string::npos;
+        }
+
+        template <typename F>
+        void run(const std::string& name, long opsPerCall, F&& body) {
+            // Finds an iteration count that runs for at least minTime, then keeps the fastest and
+            // the median of several repetitions at that count.
+            if (!selected(name))
+                return;
+
+            long calls = 1;
+            while (true) {
+                double seconds = time_calls(calls, body);
+                if (seconds >= minTime || calls >= (1L << 40))
+                    break;
+                calls = seconds <= 0 ? calls * 10 : std::max(calls * 2, long(calls * minTime / seconds * 1.2));
+            }
+
+            std::vector<double> perOp;
+            for (int rep = 0; rep < repetitions; rep++)
+                perOp.push_back(time_calls(calls, body) * 1e9 / (double(calls) * opsPerCall));
+            std::sort(perOp.begin(), perOp.end());
+
+            BenchResult result;
+            result.name = name;
+            result.iterations = calls * opsPerCall;
+            result.nsPerOp = perOp.front();
+            result.nsPerOpMedian = perOp[perOp.size() / 2];
+            results.push_back(result);
+            std::clog << name << ": " << result.nsPerOp << " ns/op\n";
+        }
+
+        void write_json(std::ostream& out) const {
+            out << "{\n  \"compiler\": \"" << __VERSION__ << "\",\n  \"benchmarks\": [\n";
+            for (size_t i = 0; i < results.size(); i++) {
+                const BenchResult& r = results[i];
+                out << "    {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+                    << ", \"ns_per_op\": " << r.nsPerOp << ", \"ns_per_op_median\": " << r.nsPerOpMedian
+                    << ", \"ops_per_sec\": " << 1e9 / r.nsPerOp << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+            }
+            out << "  ]\n}\n";
+        }
+
+    private:
+        volatile float sink = 0;
+
+        template <typename F>
+        double time_calls(long calls, F& body) {
+            float accum = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (long i = 0; i < calls; i++)
+                accum += body();
+            auto end = std::chrono::steady_clock::now();
+            sink = sink + accum;
+            return std::chrono::duration<double>(end - start).count();
+        }
+};
+
+static const int rayCount = 4096;
+
+static std::vector<Ray> rays_toward(const Point3& target, float spread)
+{
+    // Rays from random points on a shell around the origin aimed near the target, so that a
+    // mix of them hit and miss.
+    std::vector<Ray> rays;
+    for (int i = 0; i < rayCount; i++) {
+        Point3 origin = 10 * random_unit_vector();
+        Point3 aim = target + spread * Vector3::random(-1, 1);
+        rays.push_back(Ray(origin, aim - origin, random_float()));
+    }
+    return rays;
+}
+
+template <typename Primitive>
+static void bench_primitive(BenchRunner& runner, const std::string& name, const Primitive& prim, const std::vector<Ray>& rays)
+{
+    runner.run(name, rayCount, [&] {
+        float hits = 0;
+        HitRecord rec;
+        for (const Ray& r : rays)
+            if (prim.hit(r, Interval(0.001, infinity), rec))
+                hits += rec.t;
+        return hits;
+    });
+}
+
+static void bench_primitives(BenchRunner& runner)
+{
+    shared_ptr<Material> mat = make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+    std::vector<Ray> rays = rays_toward(Point3(0, 0, 0), 1.5);
+
+    bench_primitive(runner, "sphere_hit", Sphere(Point3(0, 0, 0), 1, mat), rays);
+    bench_primitive(runner, "sphere_hit_moving", Sphere(Point3(0, 0, 0), Point3(0, 0.5, 0), 1, mat), rays);
+    bench_primitive(runner, "quad_hit", Quad(Point3(-1, -1, 0), Vector3(2, 0, 0), Vector3(0, 2, 0), mat), rays);
+    bench_primitive(runner, "triangle_hit", Triangle(Point3(-1, -1, 0), Vector3(2, 0, 0), Vector3(0, 2, 0), mat), rays);
+    bench_primitive(runner, "ellipse_hit", Ellipse(Point3(0, 0, 0), Vector3(1, 0, 0), Vector3(0, 1, 0), mat), rays);
+    bench_primitive(runner, "box_hit", *Box(Point3(-1, -1, -1), Point3(1, 1, 1), mat), rays);
+    bench_primitive(runner, "box_quads_hit", *BoxQuads(Point3(-1, -1, -1), Point3(1, 1, 1), mat), rays);
+
+    AABB box(Point3(-1, -1, -1), Point3(1, 1, 1));
+    runner.run("aabb_hit", rayCount, [&] {
+        float hits = 0;
+        for (const Ray& r : rays)
+            hits += box.hit(r, Interval(0.001, infinity));
+        return hits;
+    });
+}
+
+static void bench_bvh(BenchRunner& runner)
+{
+    // Random small spheres in a cube whose size grows with the count, so density stays constant.
+    shared_ptr<Material> mat = make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+
+    for (int count : { 16, 256, 4096, 65536 }) {
+        std::string size = std::to_string(count);
+        float extent = std::cbrt(float(count)) * 2;
+
+        HittableList list;
+        for (int i = 0; i < count; i++)
+            list.add(make_shared<Sphere>(Point3::random(-extent, extent), 0.5, mat));
+
+        shared_ptr<BVHNode> bvh;
+        runner.run("bvh_build/" + size, count, [&] {
+            bvh = make_shared<BVHNode>(list);
+            return bvh->bounding_box().x.min;
+        });
+        if (!bvh)
+            bvh = make_shared<BVHNode>(list);
+
+        // Refitting the same tree to its leaves' bounds, as AnimationSequence does every frame
+        // instead of rebuilding.
+        runner.run("bvh_refit/" + size, count, [&] {
+            return bvh->refit();
+        });
+
+        std::vector<Ray> rays;
+        for (int i = 0; i < rayCount; i++) {
+            Point3 origin = 3 * extent * random_unit_vector();
+            Point3 aim = Point3::random(-extent, extent);
+            rays.push_back(Ray(origin, aim - origin, random_float()));
+        }
+
+        runner.run("bvh_traversal/" + size, rayCount, [&] {
+            float hits = 0;
+            HitRecord rec;
+            for (const Ray& r : rays)
+                if (bvh->hit(r, Interval(0.001, infinity), rec))
+                    hits += rec.t;
+            return hits;
+        });
+
+        // The same spheres inserted one by one into a DynamicBVH, then edited one at a time: an
+        // edit should cost the same at any count, where bvh_build grows with it.
+        runner.run("dynamic_bvh/build/" + size, count, [&] {
+            DynamicBVH dynamic;
+            for (const shared_ptr<Hittable>& obj : list.objs)
+                dynamic.insert(obj);
+            return dynamic.bounding_box().x.min;
+        });
+
+        DynamicBVH dynamic;
+        std::vector<int> handles;
+        for (const shared_ptr<Hittable>& obj : list.objs)
+            handles.push_back(dynamic.insert(obj));
+        size_t edited = 0;
+        runner.run("dynamic_bvh/remove_insert/" + size, 1, [&] {
+            size_t i = edited++ % handles.size();
+            dynamic.remove(handles[i]);
+            handles[i] = dynamic.insert(list.objs[i]);
+            return dynamic.bounding_box().x.min;
+        });
+
+        runner.run("dynamic_bvh/traversal/" + size, rayCount, [&] {
+            float hits = 0;
+            HitRecord rec;
+            for (const Ray& r : rays)
+                if (dynamic.hit(r, Interval(0.001, infinity), rec))
+                    hits += rec.t;
+            return hits;
+        });
+
+        // Shadow rays from points in the cube to a light above it, as closest-hit and any-hit
+        // queries.
+        std::vector<Ray> shadowRays;
+        Point3 light(0, 2 * extent, 0);
+        for (int i = 0; i < rayCount; i++) {
+            Point3 origin = Point3::random(-extent, extent);
+            shadowRays.push_back(Ray(origin, light - origin, 0));
+        }
+
+        runner.run("shadow_rays/hit/" + size, rayCount, [&] {
+            float blocked = 0;
+            HitRecord rec;
+            for (const Ray& r : shadowRays)
+                blocked += bvh->hit(r, Interval(0.001, 0.999), rec);
+            return blocked;
+        });
+
+        runner.run("shadow_rays/occluded/" + size, rayCount, [&] {
+            float blocked = 0;
+            for (const Ray& r : shadowRays)
+                blocked += bvh->occluded(r, Interval(0.001, 0.999));
+            return blocked;
+        });
+
+        // The same from a 64x64 grid of points under the cube, in order, as shadow rays of
+        // neighboring pixels would be: these mostly share occluders, which the last-occluder
+        // cache exploits.
+        std::vector<Ray> gridShadowRays;
+        for (int y = 0; y < 64; y++) {
+            for (int x = 0; x < 64; x++) {
+                Point3 origin(extent * (x - 31.5f) / 32, -2 * extent, extent * (y - 31.5f) / 32);
+                gridShadowRays.push_back(Ray(origin, light - origin, 0));
+            }
+        }
+
+        runner.run("shadow_rays_coherent/hit/" + size, gridShadowRays.size(), [&] {
+            float blocked = 0;
+            HitRecord rec;
+            for (const Ray& r : gridShadowRays)
+                blocked += bvh->hit(r, Interval(0.001, 0.999), rec);
+            return blocked;
+        });
+
+        runner.run("shadow_rays_coherent/occluded/" + size, gridShadowRays.size(), [&] {
+            float blocked = 0;
+            for (const Ray& r : gridShadowRays)
+                blocked += bvh->occluded(r, Interval(0.001, 0.999));
+            return blocked;
+        });
+
+        // A 64x64 pinhole image of the whole cube, in 8x8 blocks.
+        std::vector<Ray> cameraRays;
+        Point3 eye(0, 0, 3 * extent);
+        for (int by = 0; by < 64; by += 8)
+            for (int bx = 0; bx < 64; bx += 8)
+                for (int y = by; y < by + 8; y++)
+                    for (int x = bx; x < bx + 8; x++)
+                        cameraRays.push_back(Ray(eye, Vector3((x - 31.5f) / 64, (y - 31.5f) / 64, -1), 0));
+
+        runner.run("camera_rays/single/" + size, cameraRays.size(), [&] {
+            float hits = 0;
+            HitRecord rec;
+            for (const Ray& r : cameraRays)
+                if (bvh->hit(r, Interval(0.001, infinity), rec))
+                    hits += rec.t;
+            return hits;
+        });
+
+        runner.run("camera_rays/packet8x8/" + size, cameraRays.size(), [&] {
+            float hits = 0;
+            RayPacket packet;
+            HitRecord recs[RayPacket::maxSize];
+            for (size_t first = 0; first < cameraRays.size(); first += RayPacket::maxSize) {
+                packet.clear();
+                for (int i = 0; i < RayPacket::maxSize; i++)
+                    packet.add(cameraRays[first + i]);
+                packet.finalize();
+                bvh->hit_packet(packet, recs, packet.all());
+                for (int i = 0; i < packet.size; i++)
+                    if (packet.hit[i])
+                        hits += recs[i].t;
+            }
+            return hits;
+        });
+
+        // The same density of spheres, each moving up to eight radii over the shutter, hit by
+        // the random rays at random times: the case the motion bounds of the nodes are for.
+        HittableList movingList;
+        for (int i = 0; i < count; i++) {
+            Point3 start = Point3::random(-extent, extent);
+            movingList.add(make_shared<Sphere>(start, start + 4 * random_unit_vector(), 0.5, mat));
+        }
+        BVHNode movingBvh(movingList);
+
+        TimeSplitBVH splitBvh(movingList, TimeSplitBVH::segment_count(movingList));
+
+        runner.run("motion_traversal/" + size, rayCount, [&] {
+            float hits = 0;
+            HitRecord rec;
+            for (const Ray& r : rays)
+                if (movingBvh.hit(r, Interval(0.001, infinity), rec))
+                    hits += rec.t;
+            return hits;
+        });
+
+        runner.run("motion_traversal_split/" + size, rayCount, [&] {
+            float hits = 0;
+            HitRecord rec;
+            for (const Ray& r : rays)
+                if (splitBvh.hit(r, Interval(0.001, infinity), rec))
+                    hits += rec.t;
+            return hits;
+        });
+    }
+}
+
+static void bench_materials(BenchRunner& runner)
+{
+    shared_ptr<Texture> tex = make_shared<SolidColor>(Color(0.7, 0.6, 0.5));
+    std::vector<std::pair<std::string, shared_ptr<Material>>> materials = {
+        { "lambertian", make_shared<Lambertian>(tex) },
+        { "metal", make_shared<Metal>(tex, 0.3) },
+        { "dielectric", make_shared<Dielectric>(tex, 1.5) },
+        { "diffuse_light", make_shared<DiffuseLight>(tex) },
+        { "isotropic", make_shared<Isotropic>(tex) },
+    };
+
+    // Hit records on the upper side of a unit sphere with incoming rays from above.
+    std::vector<std::pair<Ray, HitRecord>> hits;
+    for (int i = 0; i < rayCount; i++) {
+        HitRecord rec;
+        Vector3 n = random_on_hemisphere(Vector3(0, 1, 0));
+        rec.p = n;
+        rec.t = 1;
+        rec.u = random_float();
+        rec.v = random_float();
+        Ray in(rec.p + 2 * random_on_hemisphere(n), Vector3(0, 0, 0));
+        in = Ray(in.origin(), rec.p - in.origin());
+        rec.set_face_normal(in, n);
+        hits.push_back({ in, rec });
+    }
+
+    for (auto& [name, mat] : materials) {
+        for (auto& hit : hits)
+            hit.second.mat = mat;
+
+        runner.run("scatter/" + name, rayCount, [&] {
+            float sum = 0;
+            Color attenuation;
+            Ray scattered;
+            IndependentSampler sampler;
+            for (const auto& hit : hits) {
+                Color emitted = mat->emitted(hit.second.u, hit.second.v, hit.second.p);
+                if (mat->scatter(hit.first, hit.second, attenuation, scattered, sampler))
+                    sum += attenuation.x() + scattered.direction().y();
+                sum += emitted.x();
+            }
+            return sum;
+        });
+    }
+}
+
+static void bench_textures(BenchRunner& runner)
+{
+    std::vector<std::pair<std::string, shared_ptr<Texture>>> textures = {
+        { "solid", make_shared<SolidColor>(Color(0.7, 0.6, 0.5)) },
+        { "checker", make_shared<CheckerTexture>(0.32, Color(.2, .3, .1), Color(.9, .9, .9)) },
+        { "image", make_shared<ImageTexture>("marble.jpg") },
+        { "noise", make_shared<NoiseTexture>(4) },
+        { "noise_baked", make_shared<NoiseTexture>(4, AABB(Point3(-2, -2, -2), Point3(2, 2, 2)), 64) },
+    };
+
+    std::vector<Point3> points;
+    std::vector<float> uvs;
+    for (int i = 0; i < rayCount; i++) {
+        points.push_back(Point3::random(-2, 2));
+        uvs.push_back(random_float());
+    }
+
+    for (auto& [name, tex] : textures) {
+        runner.run("texture/" + name, rayCount, [&] {
+            float sum = 0;
+            for (int i = 0; i < rayCount; i++)
+                sum += tex->value(uvs[i], uvs[rayCount - 1 - i], points[i]).x();
+            return sum;
+        });
+    }
+}
+
+static void bench_perlin(BenchRunner& runner)
+{
+    Perlin perlin;
+    std::vector<Point3> points;
+    for (int i = 0; i < rayCount; i++)
+        points.push_back(Point3::random(-8, 8));
+
+    runner.run("perlin/noise", rayCount, [&] {
+        float sum = 0;
+        for (const Point3& p : points)
+            sum += perlin.noise(p);
+        return sum;
+    });
+
+    runner.run("perlin/noise_scalar", rayCount, [&] {
+        float sum = 0;
+        for (const Point3& p : points)
+            sum += perlin.noise_scalar(p);
+        return sum;
+    });
+
+    runner.run("perlin/turb7", rayCount, [&] {
+        float sum = 0;
+        for (const Point3& p : points)
+            sum += perlin.turb(p, 7);
+        return sum;
+    });
+}
+
+int main(int argc, char** argv)
+{
+    BenchRunner runner;
+    std::string out;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc)
+            runner.filter = argv[++i];
+        else if (arg == "--min-time" && i + 1 < argc)
+            runner.minTime = std::atof(argv[++i]);
+        else if (arg == "--out" && i + 1 < argc)
+            out = argv[++i];
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--filter <substring>] [--min-time <seconds>] [--out <file.json>]\n";
+            return 1;
+        }
+    }
+
+    // Fixed seed so every run benchmarks the same synthetic inputs.
+    seed_random(1);
+
+    bench_primitives(runner);
+    bench_bvh(runner);
+    bench_materials(runner);
+    bench_textures(runner);
+    bench_perlin(runner);
+
+    if (out.empty()) {
+        runner.write_json(std::cout);
+    }
+    else {
+        std::ofstream ofs(out);
+        runner.write_json(ofs);
+    }
+    return 0;
+}
@@ -0,0 +1,139 @@
+// Perlin noise throughput benchmark.
+//
+// Reports noise evaluations per second for the scalar reference, the SIMD single-point path,
+// the four-wide noise4() path, turbulence and the baked NoiseVolume, and checks that the SIMD
+// paths reproduce the scalar output bit for bit.
+//
+// Built by the perlin_bench target in CMakeLists.txt.
+
+#include "../common.h"
+
+#include "../perlin.h"
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+static const int pointCount = 1 << 20;
+
+template <typename F>
+static void report(const char* name, long evaluations, F&& body)
+{
+    auto start = std::chrono::steady_clock::now();
+    float sink = body();
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << name << ": " << (evaluations / seconds) / 1e6 << " M evals/s"
+              << " (" << seconds * 1e3 << " ms, checksum " << sink << ")\n";
+}
+
+int main()
+{
+    Perlin perlin;
+
+    // Points spread over a few lattice cells in each direction, including negative coordinates.
+    std::vector<Point3> points(pointCount);
+    for (Point3& p : points)
+        p = Point3::random(-8, 8);
+
+    int mismatches = 0;
+    for (int n = 0; n < pointCount; n += 4) {
+        float x[4], y[4], z[4], out[4];
+        for (int lane = 0; lane < 4; lane++) {
+            x[lane] = points[n + lane].x();
+            y[lane] = points[n + lane].y();
+            z[lane] = points[n + lane].z();
+        }
+        perlin.noise4(x, y, z, out);
+
+        for (int lane = 0; lane < 4; lane++) {
+            float reference = perlin.noise_scalar(points[n + lane]);
+            float simd = perlin.noise(points[n + lane]);
+            if (std::memcmp(&reference, &simd, sizeof(float)) != 0 ||
+                std::memcmp(&reference, &out[lane], sizeof(float)) != 0)
+                mismatches++;
+        }
+    }
+
+    // Turbulence through noise4() against the octave-at-a-time scalar sum.
+    for (int n = 0; n < pointCount; n += 64) {
+        float accum = 0.0;
+        Point3 temp = points[n];
+        float weight = 1.0;
+        for (int i = 0; i < 7; i++) {
+            accum += weight * perlin.noise_scalar(temp);
+            weight *= 0.5;
+            temp *= 2;
+        }
+        if (double(std::fabs(accum)) != perlin.turb(points[n], 7))
+            mismatches++;
+    }
+    std::cout << "SIMD vs scalar mismatches: " << mismatches << " of " << pointCount << "\n";
+
+    const int passes = 8;
+    const long evaluations = long(passes) * pointCount;
+
+    report("noise_scalar", evaluations, [&] {
+        float sum = 0;
+        for (int pass = 0; pass < passes; pass++)
+            for (const Point3& p : points)
+                sum += perlin.noise_scalar(p);
+        return sum;
+    });
+
+    report("noise", evaluations, [&] {
+        float sum = 0;
+        for (int pass = 0; pass < passes; pass++)
+            for (const Point3& p : points)
+                sum += perlin.noise(p);
+        return sum;
+    });
+
+    report("noise4", evaluations, [&] {
+        float sum = 0;
+        for (int pass = 0; pass < passes; pass++)
+            for (int n = 0; n < pointCount; n += 4) {
+                float x[4], y[4], z[4], out[4];
+                for (int lane = 0; lane < 4; lane++) {
+                    x[lane] = points[n + lane].x();
+                    y[lane] = points[n + lane].y();
+                    z[lane] = points[n + lane].z();
+                }
+                perlin.noise4(x, y, z, out);
+                sum += out[0] + out[1] + out[2] + out[3];
+            }
+        return sum;
+    });
+
+    // Turbulence counts one evaluation per octave.
+    const int depth = 7;
+    report("turb(depth 7), per octave", long(pointCount) * depth, [&] {
+        float sum = 0;
+        for (const Point3& p : points)
+            sum += perlin.turb(p, depth);
+        return sum;
+    });
+
+    AABB domain(Point3(-8, -8, -8), Point3(8, 8, 8));
+    auto bakeStart = std::chrono::steady_clock::now();
+    NoiseVolume volume(perlin, domain, 128);
+    double bakeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - bakeStart).count();
+    std::cout << "NoiseVolume bake (128^3): " << bakeSeconds * 1e3 << " ms, "
+              << volume.memory_bytes() / (1024.0 * 1024.0) << " MiB\n";
+
+    report("NoiseVolume lookup", evaluations, [&] {
+        float sum = 0;
+        for (int pass = 0; pass < passes; pass++)
+            for (const Point3& p : points)
+                sum += volume.noise(p);
+        return sum;
+    });
+
+    double maxError = 0;
+    for (const Point3& p : points)
+        maxError = std::fmax(maxError, std::fabs(volume.noise(p) - perlin.noise(p)));
+    std::cout << "NoiseVolume max abs error: " << maxError << "\n";
+
+    return mismatches == 0 ? 0 : 1;
+}
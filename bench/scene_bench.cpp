@@ -0,0 +1,269 @@
+// End-to-end time-to-quality benchmark.
+//
+// Renders each built-in scene progressively, one sample per pixel per pass, and at each time
+// budget records the samples reached, rays per second and the error against a stored high-spp
+// reference. Comparing error at equal time judges sampler and integrator changes fairly even
+// when they lower raw ray throughput.
+//
+// References are rendered on first use (or with --make-references) and stored as PFM in the
+// reference directory, keyed by scene name and image width.
+//
+// With --denoise the passes also gather AOVs, and every checkpoint reports the error of the
+// denoised image as well, with the denoise time kept apart from the render time.
+//
+// --sampler picks the camera's sample generator (see sampler.h, default sobol); references
+// always use the independent one. --wavefront renders with the wavefront integrator instead of
+// the depth-first one; comparing rays per second between the two on scenes with many
+// materials (final_scene, angled_balls) shows what material-sorted shading buys.
+// --packet-size sets the edge of the camera-ray packets (0: single rays). --no-bake keeps the
+// Translate/Rotate wrappers in the BVH instead of baking them into world-space primitives.
+//
+// Usage: scene_bench [--scenes a,b,...] [--width <px>] [--budgets <s,s,...>] [--denoise]
+//                    [--sampler independent|stratified|sobol|halton|bluenoise] [--wavefront]
+//                    [--packet-size <n>] [--no-bake]
+//                    [--reference-spp <n>] [--refdir <dir>] [--make-references] [--out <file.json>]
+
+#include "../common.h"
+
+#include "../bvh_cache.h"
+#include "../denoise.h"
+#include "../image_io.h"
+#include "../scenes.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+class Checkpoint {
+    public:
+        double budget;
+        double seconds;
+        int samples;
+        uint64_t rays;
+        double rmse;
+        double relMSE;
+        double denoiseSeconds = 0;
+        double denoisedRmse = 0;
+        double denoisedRelMSE = 0;
+};
+
+class SceneResult {
+    public:
+        std::string name;
+        int width;
+        int height;
+        double buildSeconds;
+        std::vector<Checkpoint> checkpoints;
+};
+
+static std::vector<std::string> split(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+static void image_error(const std::vector<Color>& accum, float scale, const std::vector<Color>& reference, double& rmse, double& relMSE)
+{
+    // RMSE over all channels of the linear image, and relative MSE with a small epsilon so
+    // dark reference pixels do not dominate.
+    double squared = 0;
+    double relative = 0;
+    for (size_t n = 0; n < accum.size(); n++) {
+        for (int c = 0; c < 3; c++) {
+            double value = scale * accum[n][c];
+            double ref = reference[n][c];
+            double diff = value - ref;
+            squared += diff * diff;
+            relative += diff * diff / (ref * ref + 1e-2);
+        }
+    }
+    double count = 3.0 * accum.size();
+    rmse = std::sqrt(squared / count);
+    relMSE = relative / count;
+}
+
+int main(int argc, char** argv)
+{
+    std::map<std::string, std::function<Scene()>> scenes = {
+        { "angled_balls", angled_balls },
+        { "my_test", my_test },
+        { "texture_test", texture_test },
+        { "noise_sphere", noise_sphere },
+        { "cornell_box", cornell_box },
+        { "final_scene", final_scene },
+    };
+
+    std::vector<std::string> selected = { "angled_balls", "my_test", "texture_test", "noise_sphere", "cornell_box", "final_scene" };
+    std::vector<double> budgets = { 0.5, 1, 2, 4 };
+    int width = 160;
+    int referenceSamples = 1024;
+    std::string refdir = "references";
+    std::string out;
+    bool makeReferences = false;
+    bool denoise = false;
+    SAMPLERTYPE samplerType = SAMPLER_SOBOL;
+    bool wavefront = false;
+    int packetSize = -1;
+    bool bakeTransforms = true;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--scenes" && i + 1 < argc)
+            selected = split(argv[++i]);
+        else if (arg == "--width" && i + 1 < argc)
+            width = std::atoi(argv[++i]);
+        else if (arg == "--budgets" && i + 1 < argc) {
+            budgets.clear();
+            for (const std::string& b : split(argv[++i]))
+                budgets.push_back(std::atof(b.c_str()));
+        }
+        else if (arg == "--reference-spp" && i + 1 < argc)
+            referenceSamples = std::atoi(argv[++i]);
+        else if (arg == "--refdir" && i + 1 < argc)
+            refdir = argv[++i];
+        else if (arg == "--make-references")
+            makeReferences = true;
+        else if (arg == "--denoise")
+            denoise = true;
+        else if (arg == "--sampler" && i + 1 < argc) {
+            if (!parse_sampler_type(argv[++i], samplerType))
+                return 1;
+        }
+        else if (arg == "--wavefront")
+            wavefront = true;
+        else if (arg == "--packet-size" && i + 1 < argc)
+            packetSize = std::atoi(argv[++i]);
+        else if (arg == "--no-bake")
+            bakeTransforms = false;
+        else if (arg == "--out" && i + 1 < argc)
+            out = argv[++i];
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--scenes a,b,...] [--width <px>] [--budgets <s,s,...>] [--denoise]\n"
+                      << "       [--sampler <type>] [--wavefront] [--packet-size <n>] [--no-bake] [--reference-spp <n>] [--refdir <dir>] [--make-references] [--out <file.json>]\n";
+            return 1;
+        }
+    }
+    std::sort(budgets.begin(), budgets.end());
+    std::filesystem::create_directories(refdir);
+
+    std::vector<SceneResult> results;
+    for (const std::string& name : selected) {
+        if (scenes.find(name) == scenes.end()) {
+            std::cerr << "ERROR: Unknown scene '" << name << "'.\n";
+            return 1;
+        }
+
+        // Reseed before building so every run (and the reference) sees the same random scene.
+        seed_random(1);
+        Scene scene = scenes[name]();
+        Camera& cam = scene.camera;
+        cam.imageWidth = width;
+
+        SceneResult result;
+        result.name = name;
+        result.width = width;
+        result.height = cam.image_height();
+
+        auto buildStart = std::chrono::steady_clock::now();
+        shared_ptr<Hittable> world = build_bvh(scene.world, "", bakeTransforms);
+        result.buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+
+        std::vector<Color> reference;
+        std::string refPath = refdir + "/" + name + "_" + std::to_string(width) + ".pfm";
+        int refWidth, refHeight;
+        if (makeReferences || !read_pfm(refPath, reference, refWidth, refHeight) ||
+            refWidth != result.width || refHeight != result.height) {
+            std::clog << "Rendering " << referenceSamples << " spp reference for " << name << "\n";
+            cam.samplerType = SAMPLER_INDEPENDENT;
+            cam.wavefront = false;
+            std::vector<Color> accum;
+            for (int s = 0; s < referenceSamples; s += 16)
+                cam.render_pass(*world, accum, uint16_t(std::min(16, referenceSamples - s)));
+            write_pfm(refPath, accum, result.width, result.height, 1.0f / referenceSamples);
+            read_pfm(refPath, reference, refWidth, refHeight);
+        }
+
+        std::vector<Color> accum;
+        AOVBuffers aovs;
+        cam.samplerType = samplerType;
+        cam.wavefront = wavefront;
+        if (packetSize >= 0)
+            cam.packetSize = uint16_t(packetSize);
+        cam.reset_ray_count();
+        double elapsed = 0;
+        int samples = 0;
+        for (double budget : budgets) {
+            while (elapsed < budget) {
+                auto passStart = std::chrono::steady_clock::now();
+                cam.render_pass(*world, accum, 1, denoise ? &aovs : nullptr);
+                elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - passStart).count();
+                samples++;
+            }
+
+            Checkpoint point;
+            point.budget = budget;
+            point.seconds = elapsed;
+            point.samples = samples;
+            point.rays = cam.rays_traced();
+            image_error(accum, 1.0f / samples, reference, point.rmse, point.relMSE);
+
+            std::clog << name << " @ " << budget << " s: " << samples << " spp, "
+                      << point.rays / elapsed / 1e6 << " Mrays/s, RMSE " << point.rmse
+                      << ", relMSE " << point.relMSE;
+            if (denoise) {
+                auto denoiseStart = std::chrono::steady_clock::now();
+                DenoiseSettings settings;
+                settings.threads = cam.threadCount;
+                std::vector<Color> denoised = Denoiser(result.width, result.height, settings).denoise(accum, aovs, samples);
+                point.denoiseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - denoiseStart).count();
+                image_error(denoised, 1.0f, reference, point.denoisedRmse, point.denoisedRelMSE);
+                std::clog << "; denoised in " << point.denoiseSeconds << " s, RMSE " << point.denoisedRmse
+                          << ", relMSE " << point.denoisedRelMSE;
+            }
+            std::clog << "\n";
+            result.checkpoints.push_back(point);
+        }
+        results.push_back(result);
+    }
+
+    std::ostringstream json;
+    json << "{\n  \"scenes\": [\n";
+    for (size_t s = 0; s < results.size(); s++) {
+        const SceneResult& r = results[s];
+        json << "    {\"name\": \"" << r.name << "\", \"sampler\": \"" << samplerTypeNames[samplerType]
+             << "\", \"integrator\": \"" << (wavefront ? "wavefront" : "depth_first") << "\", \"width\": " << r.width << ", \"height\": " << r.height
+             << ", \"build_seconds\": " << r.buildSeconds << ", \"checkpoints\": [\n";
+        for (size_t c = 0; c < r.checkpoints.size(); c++) {
+            const Checkpoint& p = r.checkpoints[c];
+            json << "      {\"budget\": " << p.budget << ", \"seconds\": " << p.seconds << ", \"spp\": " << p.samples
+                 << ", \"rays\": " << p.rays << ", \"rays_per_sec\": " << p.rays / p.seconds
+                 << ", \"rmse\": " << p.rmse << ", \"rel_mse\": " << p.relMSE;
+            if (denoise)
+                json << ", \"denoise_seconds\": " << p.denoiseSeconds << ", \"denoised_rmse\": " << p.denoisedRmse
+                     << ", \"denoised_rel_mse\": " << p.denoisedRelMSE;
+            json << "}"
+                 << (c + 1 < r.checkpoints.size() ? "," : "") << "\n";
+        }
+        json << "    ]}" << (s + 1 < results.size() ? "," : "") << "\n";
+    }
+    json << "  ]\n}\n";
+
+    if (out.empty()) {
+        std::cout << json.str();
+    }
+    else {
+        std::ofstream ofs(out);
+        ofs << json.str();
+    }
+    return 0;
+}
@@ -8,23 +8,95 @@
 #include "hittableList.h"
 
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Numbers every tree (and every edit of a DynamicBVH that removes objects) so that a thread's
+// OccluderCache can tell its tree from a later one at the same address.
+inline std::atomic<uint64_t> nextTreeGeneration{1};
+
+class OccluderCache {
+    // The primitive that answered a thread's last occluded() query on the tree `root`, in the
+    // tree's `generation`.
+    public:
+        const Hittable* root = nullptr;
+        uint64_t generation = 0;
+        const Hittable* occluder = nullptr;
+};
+
+inline OccluderCache& thread_occluder_cache()
+{
+    static thread_local OccluderCache cache;
+    return cache;
+}
+
+class MotionBounds {
+    // A box moving linearly from `start` to `end` over the shutter interval.
+    public:
+        MotionBounds(Interval shutter, const AABB& start, const AABB& end) : startTime(shutter.min) {
+            float span = shutter.max - shutter.min;
+            for (int axis = 0; axis < 3; axis++) {
+                const Interval& a = start.axis_interval(axis);
+                const Interval& b = end.axis_interval(axis);
+                min[axis] = a.min;
+                max[axis] = a.max;
+                velocityMin[axis] = (b.min - a.min) / span;
+                velocityMax[axis] = (b.max - a.max) / span;
+            }
+        }
+
+        AABB at(float time) const {
+            float dt = time - startTime;
+            AABB box;
+            box.x = Interval(min[0] + dt * velocityMin[0], max[0] + dt * velocityMax[0]);
+            box.y = Interval(min[1] + dt * velocityMin[1], max[1] + dt * velocityMax[1]);
+            box.z = Interval(min[2] + dt * velocityMin[2], max[2] + dt * velocityMax[2]);
+            return box;
+        }
+
+        bool hit(const Ray& r, Interval rayT) const {
+            // The slab test of AABB::hit against the box at the ray's time.
+            float dt = r.time() - startTime;
+            for (int axis = 0; axis < 3; axis++) {
+                float invD = 1.0f / r.direction()[axis];
+                float t0 = (min[axis] + dt * velocityMin[axis] - r.origin()[axis]) * invD;
+                float t1 = (max[axis] + dt * velocityMax[axis] - r.origin()[axis]) * invD;
+                if (t1 < t0)
+                    std::swap(t0, t1);
+                rayT.min = t0 > rayT.min ? t0 : rayT.min;
+                rayT.max = t1 < rayT.max ? t1 : rayT.max;
+                if (rayT.max <= rayT.min)
+                    return false;
+            }
+            return true;
+        }
+
+    private:
+        float startTime;
+        Point3 min, max;                    // At startTime
+        Vector3 velocityMin, velocityMax;   // Change per unit of time
+};
 
 class BVHNode : public Hittable
 {
 public:
     BVHNode(HittableList list) : BVHNode(list.objs, 0, list.objs.size()) {}
 
-    BVHNode(std::vector<shared_ptr<Hittable>> &objs, size_t start, size_t end)
+    // shutter limits the tree to rays whose time() lies in it: bounds then cover the objects
+    // over that part of the shutter interval only (see TimeSplitBVH).
+    BVHNode(std::vector<shared_ptr<Hittable>> &objs, size_t start, size_t end, Interval shutter = Interval(0, 1))
     {
         bbox = AABB::empty;
         for (size_t objectIndex=start; objectIndex < end; objectIndex++)
-            bbox = AABB(bbox, objs[objectIndex]->bounding_box());
+            bbox = AABB(bbox, shutter_box(*objs[objectIndex], shutter));
 
         int axis = bbox.longest_axis();
 
-        auto comparator = (axis == 0)   ? box_x_compare
-                          : (axis == 1) ? box_y_compare
-                                        : box_z_compare;
+        auto comparator = [shutter, axis](const shared_ptr<Hittable>& a, const shared_ptr<Hittable>& b) {
+            return shutter_box(*a, shutter).axis_interval(axis).min < shutter_box(*b, shutter).axis_interval(axis).min;
+        };
 
         size_t objectSpan = end - start;
 
@@ -42,14 +114,25 @@ public:
             std::sort(std::begin(objs) + start, std::begin(objs) + end, comparator);
 
             size_t mid = start + objectSpan / 2;
-            left = make_shared<BVHNode>(objs, start, mid);
-            right = make_shared<BVHNode>(objs, mid, end);
+            left = make_shared<BVHNode>(objs, start, mid, shutter);
+            right = make_shared<BVHNode>(objs, mid, end, shutter);
         }
+        find_child_nodes();
+        find_motion_bounds(shutter);
+    }
+
+    // Reassembles a node from already-built children, e.g. when loading a cached tree.
+    BVHNode(shared_ptr<Hittable> left, shared_ptr<Hittable> right, const AABB& bbox)
+      : left(left), right(right), bbox(bbox)
+    {
+        find_child_nodes();
+        find_motion_bounds(Interval(0, 1));
     }
 
     bool hit(const Ray &r, Interval rayT, HitRecord &rec) const override
     {
-        if (!bbox.hit(r, rayT))
+        STAT_INC(STAT_BVH_NODES);
+        if (!box_hit(r, rayT))
         {
             return false;
         }
@@ -59,32 +142,259 @@ public:
         return hitLeft || hitRight;
     }
 
+    bool occluded(const Ray &r, Interval rayT) const override
+    {
+        // Tries the primitive that stopped this thread's previous query first, since
+        // consecutive visibility rays are often blocked by the same object; then any hit in
+        // the tree will do.
+        OccluderCache& cache = thread_occluder_cache();
+        if (cache.root == this && cache.generation == generation && cache.occluder->occluded(r, rayT))
+        {
+            STAT_INC(STAT_OCCLUDER_CACHE_HITS);
+            return true;
+        }
+
+        const Hittable* occluder = nullptr;
+        if (!occluded_subtree(r, rayT, occluder))
+            return false;
+        cache.root = this;
+        cache.generation = generation;
+        cache.occluder = occluder;
+        return true;
+    }
+
+    void hit_packet(RayPacket& packet, HitRecord* recs, uint64_t active) const override
+    {
+        STAT_INC(STAT_BVH_NODES);
+        if (!packet.may_hit(bbox))
+            return;
+        if (motion)
+        {
+            uint64_t entering = 0;
+            for (uint64_t rays = active; rays; rays &= rays - 1)
+            {
+                int i = RayPacket::lowest_bit(rays);
+                if (packet.ray_hits(i, box_at(packet.rays[i].time())))
+                    entering |= uint64_t(1) << i;
+            }
+            active = entering;
+        }
+        else
+            active = packet.rays_hitting(active, bbox);
+        if (!active)
+            return;
+
+        left->hit_packet(packet, recs, active);
+        if (right != left)
+            right->hit_packet(packet, recs, active);
+    }
+
+    bool bake(const Transform& xf, HittableList& out) const override
+    {
+        // Rebuilds the subtree over its baked leaves rather than merging them into the parent's
+        // BVH: the parent splits at the object median, and a cluster of many small objects
+        // mixed in with a few large ones would skew its splits.
+        HittableList leaves;
+        if (!bake_leaves(xf, leaves))
+            return false;
+        shared_ptr<Hittable> baked = make_shared<BVHNode>(leaves);
+        baked->objectId = objectId;
+        out.add(baked);
+        return true;
+    }
+
     AABB bounding_box() const override { return bbox; }
 
+    AABB bounding_box_at(float time) const override { return box_at(time); }
+
+    float refit()
+    {
+        // Recomputes the bounds of the subtree bottom-up from its leaves' current bounds after
+        // they have moved, keeping its shape (see AnimationSequence). Returns the summed surface
+        // area of its nodes, which grows as the shape stops fitting the leaves. For trees over
+        // the whole shutter interval only.
+        float area = 0;
+        if (leftIsNode)
+            area += static_cast<BVHNode&>(*left).refit();
+        if (rightIsNode && right != left)
+            area += static_cast<BVHNode&>(*right).refit();
+        bbox = AABB(left->bounding_box(), right->bounding_box());
+        motion.reset();
+        find_motion_bounds(Interval(0, 1));
+        return area + bbox.surface_area();
+    }
+
+    const shared_ptr<Hittable>& left_child() const { return left; }
+    const shared_ptr<Hittable>& right_child() const { return right; }
+
 private:
     shared_ptr<Hittable> left;
     shared_ptr<Hittable> right;
     AABB bbox;
+    uint64_t generation = nextTreeGeneration++;     // See OccluderCache
+    bool leftIsNode = false;    // Children the any-hit traversal can descend into directly
+    bool rightIsNode = false;
+
+    // Motion blur: bbox covers the children over the whole shutter interval. Where that is
+    // much larger than the children at any one instant, the node also keeps their bounds as a
+    // box moving between those at the ends of the interval, and rays test the box at their
+    // time() instead. Upper levels, where the children spread further than they move, rarely
+    // qualify; they keep only bbox, and the bounds are out of line so static nodes stay small.
+    std::unique_ptr<MotionBounds> motion;
+    static constexpr float motionBoundsGain = 0.97f;   // Largest useful area(mid-shutter) / area(bbox)
+
+    void find_child_nodes()
+    {
+        leftIsNode = dynamic_cast<const BVHNode*>(left.get()) != nullptr;
+        rightIsNode = dynamic_cast<const BVHNode*>(right.get()) != nullptr;
+    }
 
-    static bool box_compare(
-        const shared_ptr<Hittable> a, const shared_ptr<Hittable> b, int axis_index
-    ) {
-        Interval aAxisInterval = a->bounding_box().axis_interval(axis_index);
-        Interval bAxisInterval = b->bounding_box().axis_interval(axis_index);
-        return aAxisInterval.min < bAxisInterval.min;
+    bool bake_leaves(const Transform& xf, HittableList& out) const
+    {
+        return bake_child(left, leftIsNode, xf, out) && (right == left || bake_child(right, rightIsNode, xf, out));
+    }
+
+    static bool bake_child(const shared_ptr<Hittable>& child, bool isNode, const Transform& xf, HittableList& out)
+    {
+        if (isNode)
+            return static_cast<const BVHNode&>(*child).bake_leaves(xf, out);
+        return child->bake(xf, out);
     }
 
-    static bool box_x_compare (const shared_ptr<Hittable> a, const shared_ptr<Hittable> b) {
-        return box_compare(a, b, 0);
+    void find_motion_bounds(Interval shutter)
+    {
+        AABB start = AABB(left->bounding_box_at(shutter.min), right->bounding_box_at(shutter.min));
+        AABB end = AABB(left->bounding_box_at(shutter.max), right->bounding_box_at(shutter.max));
+        if (start == end || !(AABB::lerp(start, end, 0.5f).surface_area() < motionBoundsGain * bbox.surface_area()))
+            return;
+        motion = std::make_unique<MotionBounds>(shutter, start, end);
     }
 
-    static bool box_y_compare (const shared_ptr<Hittable> a, const shared_ptr<Hittable> b) {
-        return box_compare(a, b, 1);
+    AABB box_at(float time) const
+    {
+        return motion ? motion->at(time) : bbox;
     }
 
-    static bool box_z_compare (const shared_ptr<Hittable> a, const shared_ptr<Hittable> b) {
-        return box_compare(a, b, 2);
+    bool box_hit(const Ray &r, Interval rayT) const
+    {
+        return motion ? motion->hit(r, rayT) : bbox.hit(r, rayT);
+    }
+
+    bool occluded_subtree(const Ray &r, Interval rayT, const Hittable*& occluder) const
+    {
+        STAT_INC(STAT_BVH_NODES);
+        if (!box_hit(r, rayT))
+            return false;
+        return child_occluded(left, leftIsNode, r, rayT, occluder) ||
+               (right != left && child_occluded(right, rightIsNode, r, rayT, occluder));
+    }
+
+    static bool child_occluded(const shared_ptr<Hittable>& child, bool isNode, const Ray &r, Interval rayT, const Hittable*& occluder)
+    {
+        if (isNode)
+            return static_cast<const BVHNode&>(*child).occluded_subtree(r, rayT, occluder);
+        if (!child->occluded(r, rayT))
+            return false;
+        occluder = child.get();
+        return true;
+    }
+
+    static AABB shutter_box(const Hittable& object, Interval shutter)
+    {
+        // For linear motion, the bounds at the ends of the shutter interval enclose the object
+        // throughout it.
+        if (shutter.min <= 0 && shutter.max >= 1)
+            return object.bounding_box();
+        return AABB(object.bounding_box_at(shutter.min), object.bounding_box_at(shutter.max));
+    }
+};
+
+class TimeSplitBVH : public Hittable
+{
+    // Separate trees over consecutive slices of the shutter interval, each bounding the objects
+    // over its slice only; a ray descends the one its time() falls in. Where objects move far
+    // compared to their size, every level of a single tree is built over boxes stretched along
+    // the whole motion, which overlap and are entered by rays that miss the object at their time.
+    // Costs a tree per slice in memory and build time.
+public:
+    TimeSplitBVH(const HittableList& list, int segmentCount)
+    {
+        bbox = list.bounding_box();
+        for (int s = 0; s < segmentCount; s++)
+        {
+            std::vector<shared_ptr<Hittable>> objs = list.objs;
+            Interval shutter(float(s) / segmentCount, float(s + 1) / segmentCount);
+            segments.push_back(make_shared<BVHNode>(objs, 0, objs.size(), shutter));
+        }
+    }
+
+    bool hit(const Ray &r, Interval rayT, HitRecord &rec) const override
+    {
+        return segments[segment(r.time())]->hit(r, rayT, rec);
+    }
+
+    bool occluded(const Ray &r, Interval rayT) const override
+    {
+        return segments[segment(r.time())]->occluded(r, rayT);
+    }
+
+    void hit_packet(RayPacket& packet, HitRecord* recs, uint64_t active) const override
+    {
+        // The rays of a packet may fall in different slices; each slice traces its own.
+        uint64_t masks[maxSegments] = {};
+        for (uint64_t rays = active; rays; rays &= rays - 1)
+        {
+            int i = RayPacket::lowest_bit(rays);
+            masks[segment(packet.rays[i].time())] |= uint64_t(1) << i;
+        }
+        for (size_t s = 0; s < segments.size(); s++)
+            if (masks[s])
+                segments[s]->hit_packet(packet, recs, masks[s]);
+    }
+
+    bool bake(const Transform& xf, HittableList& out) const override
+    {
+        return segments[0]->bake(xf, out);
+    }
+
+    AABB bounding_box() const override { return bbox; }
+
+    static const int maxSegments = 4;   // More trees cost more in cache misses than they save
+
+    static int segment_count(const HittableList& list)
+    {
+        // 1 unless objects' bounds over the whole shutter interval average more than twice their
+        // area at an instant; below that the interpolated node bounds of a single tree do as
+        // well. Otherwise the fewest slices (up to maxSegments) that bring it under twice.
+        auto mean_area_ratio = [&list](float span) {
+            double sum = 0;
+            for (const shared_ptr<Hittable>& obj : list.objs)
+            {
+                float instant = obj->bounding_box_at(0.5f).surface_area();
+                float swept = AABB(obj->bounding_box_at(0.5f - span / 2), obj->bounding_box_at(0.5f + span / 2)).surface_area();
+                sum += instant > 0 && std::isfinite(swept) ? swept / instant : 1;
+            }
+            return list.objs.empty() ? 1 : sum / list.objs.size();
+        };
+
+        const double maxAreaRatio = 2;
+        if (mean_area_ratio(1) <= maxAreaRatio)
+            return 1;
+        int count = 2;
+        while (count < maxSegments && mean_area_ratio(1.0f / count) > maxAreaRatio)
+            count *= 2;
+        return count;
+    }
+
+private:
+    std::vector<shared_ptr<BVHNode>> segments;
+    AABB bbox;
+
+    int segment(float time) const
+    {
+        int s = int(time * segments.size());
+        return s < 0 ? 0 : s >= int(segments.size()) ? int(segments.size()) - 1 : s;
     }
 };
 
-#endif
\ No newline at end of file
+#endif
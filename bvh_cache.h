@@ -0,0 +1,216 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "hittableList.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// On-disk BVH cache.
+//
+// The BVH build only looks at the bounding boxes of the world's objects, so the tree is fully
+// determined by that sequence of boxes. The cache key is a hash of it, and the file stores the
+// tree as a flat array of nodes whose children are either other nodes or indices into the
+// world's object list.
+
+struct BVHCacheNode {
+    int32_t left;       // >= 0: node index, < 0: world object -(index + 1)
+    int32_t right;
+    float bounds[6];
+};
+
+struct BVHCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t hash;
+    uint32_t objectCount;
+    uint32_t nodeCount;
+};
+
+static const char bvhCacheMagic[4] = { 'R', 'T', 'B', 'V' };
+static const uint32_t bvhCacheVersion = 1;
+
+inline uint64_t bvh_content_hash(const HittableList& world)
+{
+    // 64-bit FNV-1a over the object count and every object's bounding box.
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    };
+
+    uint64_t count = world.objs.size();
+    mix(&count, sizeof(count));
+    for (const shared_ptr<Hittable>& obj : world.objs) {
+        AABB box = obj->bounding_box();
+        float bounds[6] = { box.x.min, box.x.max, box.y.min, box.y.max, box.z.min, box.z.max };
+        mix(bounds, sizeof(bounds));
+    }
+    return hash;
+}
+
+inline std::string bvh_cache_path(const std::string& cacheDir, uint64_t hash)
+{
+    std::ostringstream name;
+    name << cacheDir << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bvh";
+    return name.str();
+}
+
+class BVHCacheWriter {
+    public:
+        BVHCacheWriter(const HittableList& world) {
+            for (size_t i = 0; i < world.objs.size(); i++)
+                objectIndex.emplace(world.objs[i].get(), int32_t(i));
+        }
+
+        bool save(const std::string& filename, const BVHNode& root, uint64_t hash) {
+            TRACE_SCOPE("bvh cache save", "bvh");
+            nodes.clear();
+            add_node(root);
+
+            std::ofstream ofs(filename, std::ios::binary);
+            if (!ofs) {
+                std::cerr << "ERROR: Could not write BVH cache '" << filename << "'.\n";
+                return false;
+            }
+
+            BVHCacheHeader header = {};
+            std::memcpy(header.magic, bvhCacheMagic, sizeof(header.magic));
+            header.version = bvhCacheVersion;
+            header.hash = hash;
+            header.objectCount = uint32_t(objectIndex.size());
+            header.nodeCount = uint32_t(nodes.size());
+
+            ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            ofs.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(BVHCacheNode));
+            return bool(ofs);
+        }
+
+    private:
+        std::unordered_map<const Hittable*, int32_t> objectIndex;
+        std::vector<BVHCacheNode> nodes;
+
+        int32_t add_node(const BVHNode& node) {
+            int32_t index = int32_t(nodes.size());
+            nodes.emplace_back();
+
+            AABB box = node.bounding_box();
+            float bounds[6] = { box.x.min, box.x.max, box.y.min, box.y.max, box.z.min, box.z.max };
+            int32_t left = add_child(node.left_child());
+            int32_t right = add_child(node.right_child());
+
+            nodes[index].left = left;
+            nodes[index].right = right;
+            std::memcpy(nodes[index].bounds, bounds, sizeof(bounds));
+            return index;
+        }
+
+        int32_t add_child(const shared_ptr<Hittable>& child) {
+            // World objects may themselves be BVHs, so look them up before treating a child as
+            // an interior node.
+            auto found = objectIndex.find(child.get());
+            if (found != objectIndex.end())
+                return -(found->second + 1);
+            return add_node(static_cast<const BVHNode&>(*child));
+        }
+};
+
+inline shared_ptr<BVHNode> load_bvh_cache(const std::string& filename, const HittableList& world, uint64_t hash)
+{
+    TRACE_SCOPE("bvh cache load", "bvh");
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs)
+        return nullptr;
+
+    BVHCacheHeader header;
+    if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, bvhCacheMagic, sizeof(header.magic)) != 0 ||
+        header.version != bvhCacheVersion || header.hash != hash ||
+        header.objectCount != world.objs.size() || header.nodeCount == 0)
+        return nullptr;
+
+    std::vector<BVHCacheNode> nodes(header.nodeCount);
+    if (!ifs.read(reinterpret_cast<char*>(nodes.data()), nodes.size() * sizeof(BVHCacheNode)))
+        return nullptr;
+
+    // Children are always written after their parent, so build from the back.
+    std::vector<shared_ptr<BVHNode>> built(nodes.size());
+    for (size_t n = nodes.size(); n-- > 0;) {
+        const BVHCacheNode& node = nodes[n];
+        shared_ptr<Hittable> children[2];
+        int32_t refs[2] = { node.left, node.right };
+
+        for (int c = 0; c < 2; c++) {
+            int32_t ref = refs[c];
+            if (ref < 0 && size_t(-(ref + 1)) < world.objs.size())
+                children[c] = world.objs[-(ref + 1)];
+            else if (ref > int32_t(n) && size_t(ref) < nodes.size())
+                children[c] = built[ref];
+            else
+                return nullptr;
+        }
+
+        // Assign the intervals directly: the stored bounds are already padded.
+        const float* b = node.bounds;
+        AABB box;
+        box.x = Interval(b[0], b[1]);
+        box.y = Interval(b[2], b[3]);
+        box.z = Interval(b[4], b[5]);
+        built[n] = make_shared<BVHNode>(children[0], children[1], box);
+    }
+    return built[0];
+}
+
+inline shared_ptr<Hittable> build_bvh(const HittableList& source, const std::string& cacheDir = "", bool bakeTransforms = true,
+                                      bool timeSplit = false)
+{
+    // Builds the acceleration structure for a world without modifying it. When cacheDir is set,
+    // a tree saved there for identical geometry is loaded instead, and fresh builds are saved.
+    // With bakeTransforms, static Translate/Rotate chains are first flattened into world-space
+    // primitives (see bake_transforms()), and the tree is built over those.
+    HittableList world = bakeTransforms ? bake_transforms(source) : source;
+    TRACE_SCOPE("bvh", "bvh", "objects", int64_t(world.objs.size()));
+    if (world.objs.empty())
+        return make_shared<HittableList>(world);
+
+    // With timeSplit, scenes with enough motion blur get a tree per slice of the shutter
+    // interval. The disk cache holds a single tree, so these are always built.
+    int segments = timeSplit ? TimeSplitBVH::segment_count(world) : 1;
+    if (segments > 1) {
+        TRACE_SCOPE("bvh build", "bvh", "segments", int64_t(segments));
+        return make_shared<TimeSplitBVH>(world, segments);
+    }
+
+    if (cacheDir.empty()) {
+        TRACE_SCOPE("bvh build", "bvh");
+        return make_shared<BVHNode>(world);
+    }
+
+    uint64_t hash = bvh_content_hash(world);
+    std::string filename = bvh_cache_path(cacheDir, hash);
+
+    shared_ptr<BVHNode> root = load_bvh_cache(filename, world, hash);
+    if (root)
+        return root;
+
+    {
+        TRACE_SCOPE("bvh build", "bvh");
+        root = make_shared<BVHNode>(world);
+    }
+    BVHCacheWriter(world).save(filename, *root, hash);
+    return root;
+}
+
+#endif
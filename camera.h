@@ -2,17 +2,32 @@
 #define CAMERA_H
 
 #include "common.h"
+#include "aov.h"
 #include "bvh.h"
+#include "bvh_cache.h"
+#include "denoise.h"
+#include "distributed.h"
 #include "hittable.h"
+#include "heatmap.h"
 #include "hittableList.h"
+#include "image_io.h"
 #include "material.h"
-#include <fstream>
+#include "parallel.h"
+#include "perf_counters.h"
+#include "sampler.h"
+#include "wavefront.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
 
 class Camera
 {
 public:
     float aspectRatio = 1.0f;
-    uint16_t imageWidth = 100;
+    uint32_t imageWidth = 100;       // 32-bit for poster-size renders (see render_streaming()), up to maxImageDimension
     uint16_t samplesPerPixel = 10;
     uint16_t maxDepth = 10;
     Color background = Color(0.70, 0.80, 1.00);
@@ -25,36 +40,276 @@ public:
     float defocusAngle = 0;
     float focusDist = 10;
 
+    // Directory for saved BVHs keyed by the world's geometry; empty disables the disk cache.
+    std::string bvhCacheDir;
+
+    // Flatten static Translate/Rotate chains into world-space primitives before the BVH build.
+    bool bakeTransforms = true;
+
+    // Build a tree per slice of the shutter interval for scenes with heavy motion blur (see
+    // TimeSplitBVH). Off by default: in the microbenchmarks the single tree with interpolated
+    // node bounds traverses faster, and only it can be cached on disk and refitted.
+    bool timeSplitBVH = false;
+
+    // Diagnostic mode: also write per-pixel BVH nodes visited, primitives tested and time spent
+    // (see heatmap.h).
+    bool costHeatmap = false;
+
+    // Render threads (0: one per hardware thread) and the edge of the square tiles they take
+    // turns on. Each tile seeds its own random stream, so images do not depend on the thread
+    // count.
+    uint16_t threadCount = 0;
+    uint16_t tileSize = 32;
+
+    // Measure hardware counters (see perf_counters.h) per phase and per render thread, written
+    // to filename + ".perf.json".
+    bool perfCounters = false;
+
+    // Gather first-hit albedo, normal and depth while rendering and filter the image with them
+    // (see denoise.h). The unfiltered image goes to filename + ".noisy.ppm".
+    bool denoise = false;
+    DenoiseSettings denoiseSettings;
 
-    void render(const std::string filename, HittableList& world)
+    // AOVTYPE flags of auxiliary buffers to write with the image, as float (ids: uint) channels
+    // of filename + ".aov.exr" next to the final R, G and B.
+    unsigned aovOutputs = 0;
+
+    // Generator of the pixel, lens, time and scattering samples (see sampler.h). Scrambled
+    // Sobol reaches a given error in about three quarters of the time of independent samples.
+    SAMPLERTYPE samplerType = SAMPLER_SOBOL;
+
+    // Trace with the wavefront integrator (see wavefront.h): batches of up to wavefrontBatch
+    // paths per thread advance one bounce at a time and are shaded grouped by material. Cost
+    // heatmaps need one pixel traced at a time and keep the depth-first integrator.
+    bool wavefront = false;
+    uint32_t wavefrontBatch = 4096;
+
+    // Camera rays of packetSize x packetSize pixel blocks (at most 8 x 8) are traced through the
+    // BVH as one packet (see packet.h); 0 traces every ray on its own. Scattered rays are too
+    // divergent for packets and always go one at a time.
+    uint16_t packetSize = 8;
+
+    // When positive, render() samples for about this many seconds instead of samplesPerPixel:
+    // passes over the whole image are timed and sized so that the last ends by the deadline, and
+    // every pixel gets the same number of samples (see samples_rendered()). BVH building,
+    // denoising and writing the files are not counted. Cost heatmaps show the last pass.
+    double timeBudget = 0;
+
+    void render(const std::string filename, const HittableList& world)
     {
-        world = HittableList(make_shared<BVHNode>(world));
+        // Builds (or loads) the acceleration structure for this render only; the caller's
+        // world is left unchanged. Use build_bvh() and the overload below to share one tree
+        // between several renders.
+        PerfReport perf;
+        shared_ptr<Hittable> accel;
+        {
+            PerfScope scope(perfCounters ? &perf.phases[PERF_PHASE_BVH_BUILD] : nullptr);
+            accel = build_bvh(world, bvhCacheDir, bakeTransforms, timeSplitBVH);
+        }
+        render_image(filename, *accel, perf);
+    }
+
+    void render(const std::string filename, const Hittable& world)
+    {
+        PerfReport perf;
+        render_image(filename, world, perf);
+    }
+
+    bool render_distributed(const std::string filename, const HittableList& world, const DistributedSettings& settings)
+    {
+        shared_ptr<Hittable> accel = build_bvh(world, bvhCacheDir, bakeTransforms, timeSplitBVH);
+        return render_distributed(filename, *accel, settings);
+    }
+
+    bool render_distributed(const std::string filename, const Hittable& world, const DistributedSettings& settings)
+    {
+        // Renders like render(), but with the tiles spread over forked worker processes (see
+        // distributed.h) instead of threads. Each tile is seeded as in render(), so the image is
+        // the same whichever worker renders it. Only the image is gathered: denoising, AOVs,
+        // heatmaps, counters and time budgets need a render in one process.
+        if (denoise || aovOutputs || costHeatmap || perfCounters || timeBudget > 0)
+            std::clog << "Worker processes render the image only; denoising, AOVs, heatmaps, perf counters and time budgets are skipped.\n";
         initialize();
+        raysTraced = 0;
+        firstSampleIndex = 0;
+        auto start = std::chrono::steady_clock::now();
 
-        std::ofstream ofs(filename, std::ios::binary);
+        std::vector<Color> pixels(size_t(imageWidth) * imageHeight);
+        TileJob job;
+        begin_tiles(job, world, samplesPerPixel, pixels, nullptr, nullptr, nullptr, "", 1);
+        size_t tilesDone = 0;
+        bool rendered = run_tile_workers(job.tileCount, settings,
+            [&](size_t t, TileResult& result) {
+                // In a worker: render into its copy of pixels, then send the tile's sums.
+                int x0, y0, x1, y1;
+                tile_bounds(job, t, x0, y0, x1, y1);
+                uint64_t raysBefore = job.threadRays[0];
+                render_tile(job, t, 0);
+                result.rays = job.threadRays[0] - raysBefore;
+                for (int j = y0; j < y1; j++)
+                    for (int i = x0; i < x1; i++)
+                        for (int c = 0; c < 3; c++)
+                            result.values.push_back(pixels[size_t(j) * imageWidth + i][c]);
+            },
+            [&](size_t t, const TileResult& result) {
+                int x0, y0, x1, y1;
+                tile_bounds(job, t, x0, y0, x1, y1);
+                size_t n = 0;
+                for (int j = y0; j < y1; j++)
+                    for (int i = x0; i < x1; i++, n += 3)
+                        pixels[size_t(j) * imageWidth + i] = Color(result.values[n], result.values[n + 1], result.values[n + 2]);
+                raysTraced += result.rays;
+                std::clog << "\rTiles remaining for " << filename << ": " << (job.tileCount - ++tilesDone) << ' ' << std::flush;
+            });
+        if (!rendered)
+            return false;
 
-        ofs << "P3\n"
-            << imageWidth << ' ' << imageHeight << "\n255\n";
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::clog << "\rRender for " << filename << " has been completed in " << seconds << " s." << std::endl;
+        TRACE_SCOPE("write image", "io");
+        return write_ppm(filename, pixels, imageWidth, imageHeight, pixelSamplesScale);
+    }
 
-        for (uint16_t j = 0; j < imageHeight; j++)
+    bool render_streaming(const std::string filename, const HittableList& world)
+    {
+        shared_ptr<Hittable> accel = build_bvh(world, bvhCacheDir, bakeTransforms, timeSplitBVH);
+        return render_streaming(filename, *accel);
+    }
+
+    bool render_streaming(const std::string filename, const Hittable& world)
+    {
+        // Renders like render(), but one row of tiles at a time, appending each finished row to
+        // the file (see ImageRowWriter: binary PPM, or PFM for a ".pfm" filename) so that only
+        // that row is ever in memory, for images larger than RAM. Tiles are seeded as in
+        // render(), so the pixels are the same. Denoising, AOVs, heatmaps, perf counters and
+        // time budgets need the whole image and are skipped.
+        if (denoise || aovOutputs || costHeatmap || perfCounters || timeBudget > 0)
+            std::clog << "Streaming renders write the image only; denoising, AOVs, heatmaps, perf counters and time budgets are skipped.\n";
+        TRACE_SCOPE("streaming render", "render");
+        initialize();
+        raysTraced = 0;
+        firstSampleIndex = 0;
+        samplesRendered = samplesPerPixel;
+        auto start = std::chrono::steady_clock::now();
+
+        ImageRowWriter writer;
+        if (!writer.open(filename, imageWidth, imageHeight, pixelSamplesScale))
+            return false;
+        unsigned threads = resolve_thread_count(threadCount);
+        std::vector<Color> rows;
+        TileJob job;
+        begin_tiles(job, world, samplesPerPixel, rows, nullptr, nullptr, nullptr, filename, threads);
+        int tilesY = int(job.tileCount / job.tilesX);
+        bool written = true;
+        for (int r = 0; r < tilesY && written; r++)
         {
-            std::clog << "\rScanlines remaining for " << filename << ": " << (imageHeight - j) << ' ' << std::flush;
-            for (uint16_t i = 0; i < imageWidth; i++)
+            int tileRow = writer.bottom_up() ? tilesY - 1 - r : r;
+            accumFirstRow = tileRow * job.tile;
+            int rowCount = std::min<int>(job.tile, imageHeight - accumFirstRow);
+            rows.assign(size_t(imageWidth) * rowCount, Color(0, 0, 0));
+            parallel_for(job.tilesX, threads, [&](size_t t, unsigned thread)
             {
-                Color pixelColor(0, 0, 0);
-                for (int sample = 0; sample < samplesPerPixel; sample++)
-                {
-                    Ray r = get_ray(i, j);
-                    pixelColor += ray_color(r, maxDepth, world);
-                }
-                write_color(ofs, pixelSamplesScale * pixelColor);
-            }
+                render_tile(job, size_t(tileRow) * job.tilesX + t, thread);
+            });
+            TRACE_SCOPE("write rows", "io");
+            written = writer.write_rows(rows, rowCount);
+        }
+        accumFirstRow = 0;
+        end_tiles(job);
+        if (!writer.close() || !written)
+        {
+            std::cerr << "\nERROR: Could not write all of image file '" << filename << "'.\n";
+            return false;
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::clog << "\rRender for " << filename << " has been completed in " << seconds << " s." << std::endl;
+        return true;
+    }
+
+    static bool render_views(std::vector<Camera>& views, const std::vector<std::string>& filenames, const HittableList& world)
+    {
+        // Builds the acceleration structure once, with the first view's settings, for all views.
+        if (views.empty())
+            return true;
+        shared_ptr<Hittable> accel = build_bvh(world, views[0].bvhCacheDir, views[0].bakeTransforms, views[0].timeSplitBVH);
+        return render_views(views, filenames, *accel);
+    }
+
+    static bool render_views(std::vector<Camera>& views, const std::vector<std::string>& filenames, const Hittable& world)
+    {
+        // Renders each camera's image of the same world to the matching filename, as render()
+        // would, but with the tiles of all views in one queue on one set of render threads (the
+        // first view's threadCount): threads that run out of one view's tiles go on to the next
+        // view's instead of waiting for its slowest tile. Statistics counters cannot be told
+        // apart by view, so no .stats.json is written.
+        if (views.size() != filenames.size())
+        {
+            std::cerr << "ERROR: " << views.size() << " views but " << filenames.size() << " filenames.\n";
+            return false;
+        }
+        if (views.empty())
+            return true;
+        TRACE_SCOPE("render views", "render", "views", int64_t(views.size()));
+        unsigned threads = resolve_thread_count(views[0].threadCount);
+        std::vector<ImageRender> images(views.size());
+        std::vector<PerfReport> perfs(views.size());
+        std::vector<size_t> firstTile(views.size() + 1, 0);    // Of each view in the shared queue
+        reset_stats();
+        for (size_t v = 0; v < views.size(); v++)
+        {
+            views[v].begin_image(images[v], world, perfs[v], filenames[v], threads);
+            firstTile[v + 1] = firstTile[v] + images[v].tiles.tileCount;
         }
-        std::clog << "\rRender for " << filename << " has been completed." << std::endl;
+
+        parallel_for(firstTile.back(), threads, [&](size_t t, unsigned thread)
+        {
+            size_t v = std::upper_bound(firstTile.begin(), firstTile.end(), t) - firstTile.begin() - 1;
+            views[v].render_tile(images[v].tiles, t - firstTile[v], thread);
+        });
+
+        for (size_t v = 0; v < views.size(); v++)
+            views[v].finish_image(filenames[v], images[v], perfs[v], false);
+        return true;
     }
 
+    void render_pass(const Hittable& world, std::vector<Color>& accum, uint16_t samples, AOVBuffers* aovs = nullptr)
+    {
+        // Adds `samples` more samples to every pixel of `accum`, a row-major buffer of sample
+        // sums, and to `aovs` when given. Repeated passes refine the same image progressively.
+        // Passes into an empty accum start the sample sequence over.
+        TRACE_SCOPE("render pass", "render");
+        initialize();
+        if (accum.empty())
+            firstSampleIndex = 0;
+        accum.resize(size_t(imageWidth) * imageHeight);
+        if (aovs)
+            aovs->resize(imageWidth, imageHeight);
+        render_tiles(world, samples, accum, aovs, nullptr, nullptr, "");
+        firstSampleIndex += samples;
+    }
+
+    // Pixel coordinates are ints (tiles, image writers, the denoiser), so neither side of the
+    // image may exceed 2^31 - 1 pixels: wider images are rendered this wide, and the height is
+    // clamped to it.
+    static constexpr uint32_t maxImageDimension = 2147483647;
+
+    uint32_t image_height() const
+    {
+        double height = std::min(imageWidth, maxImageDimension) / double(aspectRatio);
+        return (height < 1) ? 1 : uint32_t(std::min(height, double(maxImageDimension)));
+    }
+
+    // Ray segments (camera and scattered rays) traced since the last render() or
+    // reset_ray_count().
+    uint64_t rays_traced() const { return raysTraced; }
+    void reset_ray_count() { raysTraced = 0; }
+
+    // Samples per pixel of the last render(): samplesPerPixel, or as many as fitted in timeBudget.
+    uint32_t samples_rendered() const { return samplesRendered; }
+
 private:
-    uint16_t imageHeight;
+    uint32_t imageHeight;
     float pixelSamplesScale;
     Point3 cameraCenter;
     Point3 pixel00Loc;
@@ -64,11 +319,21 @@ private:
     Vector3 defocusDiskU;
     Vector3 defocusDiskV;
 
+    uint64_t raysTraced = 0;
+    uint64_t renderPasses = 0;
+    uint32_t firstSampleIndex = 0;  // Index of the next pass's first sample in every pixel
+    uint32_t samplesRendered = 0;
+    int accumFirstRow = 0;          // Image row of the accum buffer's first row (see render_streaming())
+
     void initialize()
     {
         // Image
-        imageHeight = int(imageWidth / aspectRatio);
-        imageHeight = (imageHeight < 1) ? 1 : imageHeight;
+        if (imageWidth > maxImageDimension)
+        {
+            std::clog << "WARNING: Image width " << imageWidth << " is clamped to " << maxImageDimension << ".\n";
+            imageWidth = maxImageDimension;
+        }
+        imageHeight = image_height();
         pixelSamplesScale = 1.0f / samplesPerPixel;
 
         // Camera
@@ -98,51 +363,627 @@ private:
         defocusDiskV = v * defocusRadius;
     }
 
-    Ray get_ray(uint16_t i, uint16_t j) const
+    class TileJob {
+        // One pass of samples over an image's tiles, which render threads take in any order.
+        public:
+            const Hittable* world;
+            uint16_t samples;
+            uint32_t sampleCount;       // Samples per pixel in all passes, for stratification
+            std::vector<Color>* accum;
+            AOVBuffers* aovs;
+            CostHeatmap* heatmap;
+            PerfReport* perf;
+            std::string progressName;
+            int tile;
+            int tilesX;
+            size_t tileCount;
+            uint64_t seedBase;
+            bool useWavefront;
+            bool usePackets;
+            std::vector<uint64_t> threadRays;       // By render thread
+            std::vector<WavefrontQueues> queues;    // By render thread
+            std::atomic<size_t> tilesDone{0};
+    };
+
+    class ImageRender {
+        // The buffers of one render_image(), from its first tile to its written files.
+        public:
+            std::vector<Color> pixels;
+            CostHeatmap heatmap;
+            AOVBuffers aovs;
+            TileJob tiles;
+            std::chrono::steady_clock::time_point start;
+    };
+
+    void render_image(const std::string& filename, const Hittable& world, PerfReport& perf)
+    {
+        // With statistics compiled in, the counters for this render are written to
+        // filename + ".stats.json".
+        TRACE_SCOPE("render", "render");
+        unsigned threads = resolve_thread_count(threadCount);
+        ImageRender image;
+        reset_stats();
+        begin_image(image, world, perf, filename, threads);
+        if (timeBudget > 0)
+            render_budgeted(filename, image, threads);
+        else
+            parallel_for(image.tiles.tileCount, threads, [&](size_t t, unsigned thread)
+            {
+                render_tile(image.tiles, t, thread);
+            });
+        finish_image(filename, image, perf, true);
+    }
+
+    void render_budgeted(const std::string& filename, ImageRender& image, unsigned threads)
+    {
+        // Renders passes over all tiles until timeBudget runs out. The first pass takes one
+        // sample per pixel; each later one as many as the previous pass's time per sample
+        // predicts will fit in the rest of the budget, less a margin for timing noise, but no
+        // more than are already done, so the estimate is refined before the last, largest
+        // passes. A pass is never cut short, so the image is uniformly sampled when time is up.
+        // Samplers that stratify over the pixel's sample count are given the total the first
+        // pass predicts, kept for all later passes so that their strata line up.
+        TRACE_SCOPE("budgeted render", "render");
+        const double margin = 0.05;     // Of the remaining time
+        TileJob& job = image.tiles;
+        uint32_t samples = 1;
+        uint32_t done = 0;
+        int passes = 0;
+        uint32_t planned = 1;           // Samples per pixel in all passes, as first predicted
+        double predicted = 0;           // Of the last pass's end, when it was planned
+        double elapsed = 0;
+        while (true)
+        {
+            auto passStart = std::chrono::steady_clock::now();
+            begin_tiles(job, *job.world, uint16_t(samples), *job.accum, job.aovs, job.heatmap, job.perf, job.progressName, threads);
+            job.sampleCount = std::max(planned, firstSampleIndex + samples);
+            parallel_for(job.tileCount, threads, [&](size_t t, unsigned thread)
+            {
+                render_tile(job, t, thread);
+            });
+            firstSampleIndex += samples;
+            done += samples;
+            passes++;
+
+            auto now = std::chrono::steady_clock::now();
+            double secondsPerSample = std::chrono::duration<double>(now - passStart).count() / samples;
+            elapsed = std::chrono::duration<double>(now - image.start).count();
+            double remaining = (timeBudget - elapsed) * (1 - margin);
+            if (passes == 1 && remaining > 0)
+                planned = uint32_t(std::min<double>(done + remaining / secondsPerSample, 4294967295.0));
+            double fitting = std::min<double>({ remaining / secondsPerSample, double(done), 65535.0 });
+            if (fitting < 1)
+                break;
+            end_tiles(job);     // finish_image() ends the last pass
+            samples = uint32_t(fitting);
+            predicted = elapsed + samples * secondsPerSample;
+        }
+
+        samplesRendered = done;
+        pixelSamplesScale = 1.0f / done;
+        std::clog << "\rTime budget of " << timeBudget << " s for " << filename << ": " << done << " samples per pixel in "
+                  << passes << " passes, " << elapsed << " s";
+        if (passes > 1)
+            std::clog << " (the last pass was predicted to end at " << predicted << " s)";
+        std::clog << "." << std::endl;
+    }
+
+    void begin_image(ImageRender& image, const Hittable& world, PerfReport& perf, const std::string& filename, unsigned threads)
+    {
+        if (perfCounters)
+            perf.note_available(thread_perf_counters());
+        initialize();
+        raysTraced = 0;
+        firstSampleIndex = 0;
+        samplesRendered = samplesPerPixel;
+        image.start = std::chrono::steady_clock::now();
+
+        image.pixels.assign(size_t(imageWidth) * imageHeight, Color(0, 0, 0));
+        if (costHeatmap)
+            image.heatmap.resize(imageWidth, imageHeight);
+        bool gatherAOVs = denoise || aovOutputs != 0;
+        if (gatherAOVs)
+            image.aovs.resize(imageWidth, imageHeight);
+
+        begin_tiles(image.tiles, world, samplesPerPixel, image.pixels, gatherAOVs ? &image.aovs : nullptr,
+                    costHeatmap ? &image.heatmap : nullptr, perfCounters ? &perf : nullptr, filename, threads);
+    }
+
+    void finish_image(const std::string& filename, ImageRender& image, PerfReport& perf, bool writeStats)
+    {
+        end_tiles(image.tiles);
+        std::vector<Color>& pixels = image.pixels;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - image.start).count();
+        std::clog << "\rRender for " << filename << " has been completed in " << seconds << " s." << std::endl;
+
+        double denoiseSeconds = 0;
+        if (denoise)
+        {
+            TRACE_SCOPE("denoise", "render");
+            write_ppm(filename + ".noisy.ppm", pixels, imageWidth, imageHeight, pixelSamplesScale);
+
+            auto denoiseStart = std::chrono::steady_clock::now();
+            DenoiseSettings settings = denoiseSettings;
+            if (settings.threads == 0)
+                settings.threads = threadCount;
+            pixels = Denoiser(imageWidth, imageHeight, settings).denoise(pixels, image.aovs, samplesRendered);
+            denoiseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - denoiseStart).count();
+            std::clog << "Denoised " << filename << " in " << denoiseSeconds << " s." << std::endl;
+        }
+
+        {
+            TRACE_SCOPE("write image", "io");
+            PerfScope scope(perfCounters ? &perf.phases[PERF_PHASE_WRITE_IMAGE] : nullptr);
+            float scale = denoise ? 1.0f : pixelSamplesScale;
+            write_ppm(filename, pixels, imageWidth, imageHeight, scale);
+            if (aovOutputs)
+                write_aovs(filename + ".aov.exr", pixels, scale, image.aovs);
+        }
+#ifndef RT_DISABLE_STATS
+        if (writeStats)
+            write_stats_json(filename + ".stats.json", seconds, denoiseSeconds);
+#else
+        (void)denoiseSeconds;
+        (void)writeStats;
+#endif
+        if (costHeatmap)
+            image.heatmap.write(filename);
+        if (perfCounters)
+            write_perf_report(filename, perf);
+    }
+
+    void render_tiles(const Hittable& world, uint16_t samples, std::vector<Color>& accum, AOVBuffers* aovs, CostHeatmap* heatmap, PerfReport* perf, const std::string& progressName)
+    {
+        unsigned threads = resolve_thread_count(threadCount);
+        TileJob job;
+        begin_tiles(job, world, samples, accum, aovs, heatmap, perf, progressName, threads);
+        parallel_for(job.tileCount, threads, [&](size_t t, unsigned thread)
+        {
+            render_tile(job, t, thread);
+        });
+        end_tiles(job);
+    }
+
+    void begin_tiles(TileJob& job, const Hittable& world, uint16_t samples, std::vector<Color>& accum, AOVBuffers* aovs, CostHeatmap* heatmap,
+                     PerfReport* perf, const std::string& progressName, unsigned threads)
+    {
+        // Sets up a pass adding `samples` samples to every pixel of accum (and of aovs when
+        // given), whose tiles render_tile() then renders on `threads` threads. Progress is
+        // logged when progressName is set.
+        job.world = &world;
+        job.samples = samples;
+        job.sampleCount = std::max<uint32_t>(samplesPerPixel, firstSampleIndex + samples);
+        job.accum = &accum;
+        job.aovs = aovs;
+        job.heatmap = heatmap;
+        job.perf = perf;
+        job.progressName = progressName;
+        job.tile = std::max<int>(1, tileSize);
+        job.tilesX = int((uint64_t(imageWidth) + job.tile - 1) / job.tile);
+        int tilesY = int((uint64_t(imageHeight) + job.tile - 1) / job.tile);
+        job.tileCount = size_t(job.tilesX) * tilesY;
+        job.seedBase = renderPasses++ * job.tileCount;
+        job.tilesDone = 0;
+
+        job.threadRays.assign(threads, 0);
+        if (perf)
+            perf->threads.assign(threads, PerfCounterValues());
+        job.useWavefront = wavefront && !heatmap;
+        job.usePackets = packetSize > 0 && maxDepth > 0 && !heatmap;
+        job.queues.resize(job.useWavefront ? threads : 0);
+    }
+
+    void tile_bounds(const TileJob& job, size_t t, int& x0, int& y0, int& x1, int& y1) const
+    {
+        x0 = int(t % job.tilesX) * job.tile;
+        y0 = int(t / job.tilesX) * job.tile;
+        x1 = int(std::min<int64_t>(int64_t(x0) + job.tile, imageWidth));
+        y1 = int(std::min<int64_t>(int64_t(y0) + job.tile, imageHeight));
+    }
+
+    void render_tile(TileJob& job, size_t t, unsigned thread)
+    {
+        int x0, y0, x1, y1;
+        tile_bounds(job, t, x0, y0, x1, y1);
+        const Hittable& world = *job.world;
+        std::vector<Color>& accum = *job.accum;
+
+        TRACE_SCOPE("tile", "render", "x", x0, "y", y0);
+        PerfScope perfScope(job.perf ? &job.perf->threads[thread] : nullptr);
+        register_thread_stats();
+        seed_random(job.seedBase + t);
+        std::unique_ptr<Sampler> sampler = make_sampler(samplerType, job.sampleCount, 0);
+
+        uint64_t rays = 0;
+        if (job.useWavefront)
+            trace_wavefront(x0, y0, x1, y1, job.samples, world, accum, job.aovs, *sampler, job.queues[thread], rays);
+        else if (job.usePackets)
+            trace_packets(x0, y0, x1, y1, job.samples, world, accum, job.aovs, *sampler, rays);
+        else
+        {
+            for (int j = y0; j < y1; j++)
+            {
+                for (int i = x0; i < x1; i++)
+                {
+                    size_t n = size_t(j - accumFirstRow) * imageWidth + i;
+                    if (job.heatmap)
+                    {
+                        CostHeatmap::PixelStart pixelStart = job.heatmap->begin_pixel();
+                        accum[n] += sample_pixel(i, j, job.samples, world, rays, job.aovs, *sampler);
+                        job.heatmap->end_pixel(i, j, pixelStart);
+                    }
+                    else
+                    {
+                        accum[n] += sample_pixel(i, j, job.samples, world, rays, job.aovs, *sampler);
+                    }
+                }
+            }
+        }
+        job.threadRays[thread] += rays;
+
+        size_t done = ++job.tilesDone;
+        if (!job.progressName.empty())
+        {
+            static std::mutex progressMutex;
+            std::lock_guard<std::mutex> lock(progressMutex);
+            std::clog << "\rTiles remaining for " << job.progressName << ": " << (job.tileCount - done) << ' ' << std::flush;
+        }
+    }
+
+    void end_tiles(TileJob& job)
+    {
+        for (uint64_t rays : job.threadRays)
+            raysTraced += rays;
+        if (job.perf)
+            for (const PerfCounterValues& values : job.perf->threads)
+                job.perf->phases[PERF_PHASE_RENDER].add(values);
+    }
+
+    void write_perf_report(const std::string& filename, const PerfReport& perf) const
+    {
+        perf.write_json(filename + ".perf.json");
+        if (!perf.any_available())
+        {
+            std::clog << "Hardware counters are unavailable (perf_event_open failed; check "
+                      << "/proc/sys/kernel/perf_event_paranoid).\n";
+            return;
+        }
+
+        const PerfCounterValues& render = perf.phases[PERF_PHASE_RENDER];
+        double instructions = render.scaled(PERF_INSTRUCTIONS);
+        std::clog << "Render: IPC " << (render.scaled(PERF_CYCLES) > 0 ? instructions / render.scaled(PERF_CYCLES) : 0);
+        if (instructions > 0)
+        {
+            std::clog << ", per 1000 instructions: " << 1000 * render.scaled(PERF_L1D_MISSES) / instructions << " L1D misses, "
+                      << 1000 * render.scaled(PERF_LLC_MISSES) / instructions << " LLC misses, "
+                      << 1000 * render.scaled(PERF_BRANCH_MISSES) / instructions << " branch misses";
+        }
+        std::clog << "\n";
+    }
+
+    Color sample_pixel(int i, int j, uint16_t samples, const Hittable& world, uint64_t& rays, AOVBuffers* aovs, Sampler& sampler) const
+    {
+        Color pixelColor(0, 0, 0);
+        for (int sample = 0; sample < samples; sample++)
+        {
+            sampler.start_pixel_sample(i, j, firstSampleIndex + sample);
+            Ray r = get_ray(i, j, sampler);
+            if (aovs)
+            {
+                AOVSample aov;
+                Color sampleColor = ray_color(r, maxDepth, world, rays, sampler, &aov);
+                aovs->add(size_t(j) * imageWidth + i, aov, sampleColor);
+                pixelColor += sampleColor;
+            }
+            else
+            {
+                pixelColor += ray_color(r, maxDepth, world, rays, sampler);
+            }
+        }
+        return pixelColor;
+    }
+
+    void trace_packets(int x0, int y0, int x1, int y1, uint16_t samples, const Hittable& world, std::vector<Color>& accum,
+                       AOVBuffers* aovs, Sampler& sampler, uint64_t& rays) const
+    {
+        // Depth-first tracing of the tile, with each sample's camera rays over a block of pixels
+        // intersected as one packet. With samplers deterministic in (pixel, sample, dimension)
+        // the sums match sample_pixel() sample for sample. The independent sampler (and the
+        // stratified one past its sample count) draws from the thread's random stream, which
+        // the block's pixels here take turns on, so its images differ in noise only.
+        int block = std::min<int>(packetSize, 8);
+        RayPacket packet;
+        HitRecord recs[RayPacket::maxSize];
+        Color sums[RayPacket::maxSize];
+
+        for (int by = y0; by < y1; by += block)
+        {
+            for (int bx = x0; bx < x1; bx += block)
+            {
+                int bw = std::min(block, x1 - bx);
+                int bh = std::min(block, y1 - by);
+                for (int r = 0; r < bw * bh; r++)
+                    sums[r] = Color(0, 0, 0);
+
+                for (int sample = 0; sample < samples; sample++)
+                {
+                    uint32_t sampleIndex = firstSampleIndex + sample;
+                    packet.clear();
+                    for (int r = 0; r < bw * bh; r++)
+                    {
+                        sampler.start_pixel_sample(bx + r % bw, by + r / bw, sampleIndex);
+                        packet.add(get_ray(bx + r % bw, by + r / bw, sampler));
+                    }
+                    packet.finalize();
+                    world.hit_packet(packet, recs, packet.all());
+
+                    for (int r = 0; r < bw * bh; r++)
+                    {
+                        int i = bx + r % bw;
+                        int j = by + r / bw;
+                        rays++;
+                        STAT_INC(STAT_CAMERA_RAYS);
+                        sampler.start_pixel_sample(i, j, sampleIndex);
+                        if (aovs)
+                        {
+                            AOVSample aov;
+                            Color sampleColor = shade(packet.rays[r], packet.hit[r], recs[r], maxDepth, world, rays, sampler, &aov);
+                            aovs->add(size_t(j) * imageWidth + i, aov, sampleColor);
+                            sums[r] += sampleColor;
+                        }
+                        else
+                        {
+                            sums[r] += shade(packet.rays[r], packet.hit[r], recs[r], maxDepth, world, rays, sampler);
+                        }
+                    }
+                }
+
+                for (int r = 0; r < bw * bh; r++)
+                    accum[size_t(by + r / bw - accumFirstRow) * imageWidth + bx + r % bw] += sums[r];
+            }
+        }
+    }
+
+    void trace_wavefront(int x0, int y0, int x1, int y1, uint16_t samples, const Hittable& world, std::vector<Color>& accum,
+                         AOVBuffers* aovs, Sampler& sampler, WavefrontQueues& queues, uint64_t& rays) const
+    {
+        // Adds `samples` samples to every pixel of the tile [x0,x1) x [y0,y1), computing the same
+        // estimate as ray_color() with the bounces of a whole batch of paths interleaved.
+        size_t width = size_t(x1 - x0);
+        size_t total = width * (y1 - y0) * samples;
+        size_t batch = std::max<size_t>(1, wavefrontBatch);
+
+        for (size_t first = 0; first < total; first += batch)
+        {
+            size_t count = std::min(batch, total - first);
+            queues.start_batch(count);
+            for (size_t k = 0; k < count; k++)
+            {
+                // Pixel-major order, so a pixel's samples are generated together.
+                size_t item = first + k;
+                WavefrontPath& path = queues.paths[k];
+                size_t pixel = item / samples;
+                path.x = x0 + int(pixel % width);
+                path.y = y0 + int(pixel / width);
+                path.sampleIndex = firstSampleIndex + uint32_t(item % samples);
+                sampler.start_pixel_sample(path.x, path.y, path.sampleIndex);
+                path.ray = get_ray(path.x, path.y, sampler);
+                path.throughput = Color(1, 1, 1);
+                path.radiance = Color(0, 0, 0);
+                queues.active.push_back(uint32_t(k));
+            }
+
+            for (int bounce = 0; !queues.active.empty(); bounce++)
+            {
+                if (bounce >= maxDepth)
+                {
+                    for (uint32_t k : queues.active)
+                    {
+                        STAT_INC(STAT_TERMINATE_DEPTH);
+                        STAT_PATH_LENGTH(maxDepth);
+                        finish_path(queues.paths[k], accum, aovs);
+                    }
+                    break;
+                }
+
+                // Camera rays are intersected in packets of consecutive paths, which cover
+                // neighboring pixels.
+                bool packets = bounce == 0 && packetSize > 0;
+                if (packets)
+                {
+                    RayPacket packet;
+                    queues.primaryHit.resize(count);
+                    for (size_t start = 0; start < count; start += RayPacket::maxSize)
+                    {
+                        packet.clear();
+                        for (size_t k = start; k < std::min(count, start + RayPacket::maxSize); k++)
+                            packet.add(queues.paths[k].ray);
+                        packet.finalize();
+                        world.hit_packet(packet, &queues.hits[start], packet.all());
+                        for (int r = 0; r < packet.size; r++)
+                            queues.primaryHit[start + r] = packet.hit[r];
+                    }
+                }
+
+                // Extend: intersect every live path, retiring the misses.
+                for (uint32_t k : queues.active)
+                {
+                    WavefrontPath& path = queues.paths[k];
+                    HitRecord& rec = queues.hits[k];
+                    rays++;
+                    STAT_INC(bounce == 0 ? STAT_CAMERA_RAYS : STAT_SECONDARY_RAYS);
+                    bool hit = packets ? queues.primaryHit[k] : world.hit(path.ray, Interval(0.001, infinity), rec);
+                    if (!hit)
+                    {
+                        STAT_INC(STAT_TERMINATE_MISS);
+                        STAT_PATH_LENGTH(bounce + 1);
+                        if (bounce == 0)
+                            path.aov = AOVSample{ background, Vector3(0, 0, 0), 0.0f, 0, 0 };
+                        path.radiance += path.throughput * background;
+                        finish_path(path, accum, aovs);
+                        continue;
+                    }
+                    STAT_INC(STAT_RAY_HITS);
+                    if (bounce == 0)
+                        path.aov = AOVSample{ rec.mat->albedo(rec), rec.normal, rec.t * path.ray.direction().length(), rec.objectId, rec.mat->materialId };
+                    queues.queue_hit(k);
+                }
+
+                // Shade in material order and compact the survivors into the next queue.
+                queues.next.clear();
+                for (uint32_t k : queues.sorted_hits())
+                {
+                    WavefrontPath& path = queues.paths[k];
+                    const HitRecord& rec = queues.hits[k];
+                    Color colorFromEmission = rec.mat->emitted(rec.u, rec.v, rec.p);
+                    path.radiance += path.throughput * colorFromEmission;
+
+                    Ray scattered;
+                    Color attenuation;
+                    sampler.start_pixel_sample(path.x, path.y, path.sampleIndex);
+                    sampler.start_bounce(bounce);
+                    if (!rec.mat->scatter(path.ray, rec, attenuation, scattered, sampler))
+                    {
+                        STAT_INC(colorFromEmission.near_zero() ? STAT_TERMINATE_ABSORBED : STAT_TERMINATE_EMITTER);
+                        STAT_PATH_LENGTH(bounce + 1);
+                        finish_path(path, accum, aovs);
+                        continue;
+                    }
+                    path.throughput = path.throughput * attenuation;
+                    path.ray = scattered;
+                    queues.next.push_back(k);
+                }
+                queues.active.swap(queues.next);
+            }
+        }
+    }
+
+    void finish_path(const WavefrontPath& path, std::vector<Color>& accum, AOVBuffers* aovs) const
+    {
+        accum[size_t(path.y - accumFirstRow) * imageWidth + path.x] += path.radiance;
+        if (aovs)
+            aovs->add(size_t(path.y) * imageWidth + path.x, path.aov, path.radiance);
+    }
+
+    bool write_aovs(const std::string& filename, const std::vector<Color>& pixels, float scale, const AOVBuffers& aovs) const
+    {
+        std::vector<ExrChannel> channels = {
+            ExrChannel::component("R", pixels, 0, scale),
+            ExrChannel::component("G", pixels, 1, scale),
+            ExrChannel::component("B", pixels, 2, scale),
+        };
+        if (aovOutputs & AOV_ALBEDO)
+        {
+            channels.push_back(ExrChannel::component("albedo.R", aovs.albedo, 0, pixelSamplesScale));
+            channels.push_back(ExrChannel::component("albedo.G", aovs.albedo, 1, pixelSamplesScale));
+            channels.push_back(ExrChannel::component("albedo.B", aovs.albedo, 2, pixelSamplesScale));
+        }
+        if (aovOutputs & AOV_NORMAL)
+        {
+            channels.push_back(ExrChannel::component("N.X", aovs.normal, 0, pixelSamplesScale));
+            channels.push_back(ExrChannel::component("N.Y", aovs.normal, 1, pixelSamplesScale));
+            channels.push_back(ExrChannel::component("N.Z", aovs.normal, 2, pixelSamplesScale));
+        }
+        if (aovOutputs & AOV_DEPTH)
+        {
+            ExrChannel depth;
+            depth.name = "Z";
+            depth.floats = aovs.depth.data();
+            depth.scale = pixelSamplesScale;
+            channels.push_back(depth);
+        }
+        if (aovOutputs & AOV_OBJECT_ID)
+        {
+            ExrChannel ids;
+            ids.name = "objectId";
+            ids.uints = aovs.objectId.data();
+            channels.push_back(ids);
+        }
+        if (aovOutputs & AOV_MATERIAL_ID)
+        {
+            ExrChannel ids;
+            ids.name = "materialId";
+            ids.uints = aovs.materialId.data();
+            channels.push_back(ids);
+        }
+        return write_exr(filename, channels, imageWidth, imageHeight);
+    }
+
+    Ray get_ray(int i, int j, Sampler& sampler) const
     {
         // Construct a camera ray originating from the origin and directed at randomly sampled
         // point around the pixel location i, j.
 
-        Vector3 offset = sample_square();
+        Vector3 offset = sample_square(sampler);
         Vector3 pixelSample = pixel00Loc + ((i + offset.x()) * pixelDeltaU) + ((j + offset.y()) * pixelDeltaV);
 
-        Point3 rayOrigin = (defocusAngle <= 0) ? cameraCenter : defocus_disk_sample();
+        Point3 rayOrigin = (defocusAngle <= 0) ? cameraCenter : defocus_disk_sample(sampler);
         Vector3 rayDirection = pixelSample - rayOrigin;
-        float rayTime = random_float();
+        sampler.set_dimension(4);
+        float rayTime = sampler.get_1d();
 
         return Ray(rayOrigin, rayDirection, rayTime);
     }
 
-    Vector3 sample_square() const
+    Vector3 sample_square(Sampler& sampler) const
     {
         // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square.
-        return Vector3(random_float() - 0.5, random_float() - 0.5, 0);
+        sampler.set_dimension(0);
+        return sampler.get_2d() - Vector3(0.5, 0.5, 0);
     }
 
-    Point3 defocus_disk_sample() const {
-        Vector3 p = random_in_unit_disk();
+    Point3 defocus_disk_sample(Sampler& sampler) const {
+        sampler.set_dimension(2);
+        Vector3 uv = sampler.get_2d();
+        Vector3 p = sample_unit_disk(uv.x(), uv.y());
         return cameraCenter + (p[0] * defocusDiskU) + (p[1] * defocusDiskV);
     }
 
-    Color ray_color(const Ray &ray, uint16_t depth, Hittable &world)
+    Color ray_color(const Ray &ray, uint16_t depth, const Hittable &world, uint64_t& rays, Sampler& sampler, AOVSample* aov = nullptr) const
     {
+        // aov, when given, receives the auxiliary values of this ray's first hit.
         if (depth <= 0)
         {
+            STAT_INC(STAT_TERMINATE_DEPTH);
+            STAT_PATH_LENGTH(maxDepth);
             return Color(0, 0, 0);
         }
 
+        rays++;
+        STAT_INC(depth == maxDepth ? STAT_CAMERA_RAYS : STAT_SECONDARY_RAYS);
         HitRecord rec;
-        if (!world.hit(ray, Interval(0.001, infinity), rec))
+        bool hit = world.hit(ray, Interval(0.001, infinity), rec);
+        return shade(ray, hit, rec, depth, world, rays, sampler, aov);
+    }
+
+    Color shade(const Ray &ray, bool hit, const HitRecord& rec, uint16_t depth, const Hittable &world, uint64_t& rays, Sampler& sampler, AOVSample* aov = nullptr) const
+    {
+        // The rest of ray_color() once ray has been intersected with the world.
+        if (!hit)
+        {
+            STAT_INC(STAT_TERMINATE_MISS);
+            STAT_PATH_LENGTH(maxDepth - depth + 1);
+            if (aov)
+                *aov = AOVSample{ background, Vector3(0, 0, 0), 0.0f, 0, 0 };
             return background;
+        }
+        STAT_INC(STAT_RAY_HITS);
+        if (aov)
+            *aov = AOVSample{ rec.mat->albedo(rec), rec.normal, rec.t * ray.direction().length(), rec.objectId, rec.mat->materialId };
 
         Ray scattered;
         Color attenuation;
         Color colorFromEmission = rec.mat->emitted(rec.u, rec.v, rec.p);
 
-        if (!rec.mat->scatter(ray, rec, attenuation, scattered))
+        sampler.start_bounce(maxDepth - depth);
+        if (!rec.mat->scatter(ray, rec, attenuation, scattered, sampler))
+        {
+            STAT_INC(colorFromEmission.near_zero() ? STAT_TERMINATE_ABSORBED : STAT_TERMINATE_EMITTER);
+            STAT_PATH_LENGTH(maxDepth - depth + 1);
             return colorFromEmission;
+        }
 
-        Color colorFromScatter = attenuation * ray_color(scattered, depth-1, world);
+        Color colorFromScatter = attenuation * ray_color(scattered, depth-1, world, rays, sampler);
 
         return colorFromEmission + colorFromScatter;
     }
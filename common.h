@@ -2,6 +2,7 @@
 #define COMMON_H
 
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <limits>
 #include <memory>
@@ -23,8 +24,30 @@ inline float degrees_to_radians(float degrees) {
     return degrees * pi / 180.0;
 }
 
+// Each thread has its own PCG32 generator, so render threads draw samples without sharing
+// state. Threads start from the same default seed; renderers reseed per tile.
+inline thread_local uint64_t randomState = 0x853c49e6748fea9bull;
+
+inline uint32_t random_uint32() {
+    uint64_t old = randomState;
+    randomState = old * 6364136223846793005ull + 1442695040888963407ull;
+    uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+    uint32_t rot = uint32_t(old >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+inline void seed_random(uint64_t seed) {
+    // splitmix64 turns nearby seeds, such as consecutive tile indices, into unrelated states.
+    seed += 0x9e3779b97f4a7c15ull;
+    seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ull;
+    seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebull;
+    randomState = seed ^ (seed >> 31);
+    random_uint32();
+}
+
 inline float random_float() {
-    return std::rand() / (RAND_MAX + 1.0f);
+    // Returns a random float in [0,1).
+    return (random_uint32() >> 8) * (1.0f / 16777216.0f);
 }
 
 inline float random_float(float min, float max) {
@@ -39,7 +62,9 @@ inline int random_int(int min, int max) {
 // Common Headers
 #include "vector3.h"
 #include "interval.h"
-#include "color.h"
+#include "Color.h"
 #include "ray.h"
+#include "stats.h"
+#include "trace.h"
 
 #endif
\ No newline at end of file
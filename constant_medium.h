@@ -14,6 +14,7 @@ class ConstantMedium : public Hittable {
         ConstantMedium(shared_ptr<Hittable> boundary, float density, Color albedo) : boundary(boundary), negInvDensity(-1/density), phaseFunction(make_shared<Isotropic>(albedo)){}
 
         bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
+            STAT_INC(STAT_TEST_MEDIUM);
             HitRecord rec1, rec2;
 
             if (!boundary->hit(r, Interval::universe, rec1))
@@ -44,6 +45,7 @@ class ConstantMedium : public Hittable {
             rec.normal = Vector3(1,0,0);
             rec.frontFace = true;
             rec.mat = phaseFunction;
+            rec.objectId = objectId;
 
             return true;
         }
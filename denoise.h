@@ -0,0 +1,178 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "common.h"
+
+#include "aov.h"
+#include "parallel.h"
+
+#include <vector>
+
+// Edge-aware à-trous wavelet denoiser (Dammertz et al. 2010, with the variance-guided color
+// weight of SVGF).
+//
+// The image is divided by the first-hit albedo, so that texture detail survives and only the
+// lighting is filtered, then it is smoothed by repeated 5x5 B3-spline passes with the tap
+// spacing doubling every iteration. Each tap is weighted by how well its normal, depth and
+// luminance agree with the center pixel. The luminance tolerance scales with the pixel's
+// estimated noise, so converged regions are left alone.
+
+class DenoiseSettings {
+    public:
+        int iterations = 5;
+        float colorSigma = 4.0f;        // In standard deviations of the pixel's luminance
+        float normalPower = 128.0f;
+        float depthSigma = 1.0f;        // In multiples of the local depth gradient per pixel
+        unsigned threads = 0;           // 0: one per hardware thread
+};
+
+class Denoiser {
+    public:
+        Denoiser(int width, int height, const DenoiseSettings& settings = DenoiseSettings())
+            : width(width), height(height), settings(settings) {}
+
+        std::vector<Color> denoise(const std::vector<Color>& colorSum, const AOVBuffers& aovs, int samples) {
+            // Takes per-pixel sums of `samples` samples and returns the filtered mean image.
+            prepare(colorSum, aovs, samples);
+
+            std::vector<Color> nextColor(color.size());
+            std::vector<float> nextVariance(variance.size());
+            for (int it = 0; it < settings.iterations; it++) {
+                int step = 1 << it;
+                blur_variance();
+                parallel_for(size_t(height), resolve_thread_count(settings.threads), [&](size_t row, unsigned) {
+                    for (int x = 0; x < width; x++)
+                        filter_pixel(x, int(row), step, nextColor, nextVariance);
+                });
+                color.swap(nextColor);
+                variance.swap(nextVariance);
+            }
+
+            std::vector<Color> result(color.size());
+            for (size_t n = 0; n < color.size(); n++)
+                result[n] = color[n] * demodulation[n];
+            return result;
+        }
+
+    private:
+        int width;
+        int height;
+        DenoiseSettings settings;
+
+        std::vector<Color> color;           // Mean color divided by albedo
+        std::vector<float> variance;        // Variance of color's luminance
+        std::vector<float> blurredVariance; // 3x3 Gaussian of variance, steadier for the weights
+        std::vector<Color> demodulation;    // Albedo, clamped away from zero
+        std::vector<Vector3> normal;
+        std::vector<float> depth;
+        std::vector<float> depthGradient;
+
+        void prepare(const std::vector<Color>& colorSum, const AOVBuffers& aovs, int samples) {
+            size_t count = size_t(width) * height;
+            float scale = 1.0f / samples;
+            color.resize(count);
+            variance.resize(count);
+            demodulation.resize(count);
+            normal.resize(count);
+            depth.resize(count);
+            depthGradient.resize(count);
+
+            for (size_t n = 0; n < count; n++) {
+                Color mean = scale * colorSum[n];
+                Color a = scale * aovs.albedo[n];
+                a = Color(std::fmax(a.x(), 0.01f), std::fmax(a.y(), 0.01f), std::fmax(a.z(), 0.01f));
+                float l = luminance(mean);
+                float sampleVariance = std::fmax(0.0f, scale * aovs.luminanceSquared[n] - l * l);
+                float albedoLuminance = luminance(a);
+
+                demodulation[n] = a;
+                color[n] = Color(mean.x() / a.x(), mean.y() / a.y(), mean.z() / a.z());
+                variance[n] = sampleVariance * scale / (albedoLuminance * albedoLuminance);
+                Vector3 nrm = aovs.normal[n];
+                normal[n] = nrm.length_squared() > 0 ? unit_vector(nrm) : nrm;
+                depth[n] = scale * aovs.depth[n];
+            }
+
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    float dx = depth_at(std::min(x + 1, width - 1), y) - depth_at(std::max(x - 1, 0), y);
+                    float dy = depth_at(x, std::min(y + 1, height - 1)) - depth_at(x, std::max(y - 1, 0));
+                    depthGradient[size_t(y) * width + x] = 0.5f * std::fmax(std::fabs(dx), std::fabs(dy));
+                }
+            }
+        }
+
+        float depth_at(int x, int y) const { return depth[size_t(y) * width + x]; }
+
+        void blur_variance() {
+            static const float kernel[2] = { 0.5f, 0.25f };
+            blurredVariance.resize(variance.size());
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    float sum = 0;
+                    float weight = 0;
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                            int qx = x + dx;
+                            int qy = y + dy;
+                            if (qx < 0 || qx >= width || qy < 0 || qy >= height)
+                                continue;
+                            float w = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                            sum += w * variance[size_t(qy) * width + qx];
+                            weight += w;
+                        }
+                    }
+                    blurredVariance[size_t(y) * width + x] = sum / weight;
+                }
+            }
+        }
+
+        void filter_pixel(int x, int y, int step, std::vector<Color>& outColor, std::vector<float>& outVariance) const {
+            static const float kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+            size_t p = size_t(y) * width + x;
+            float lp = luminance(color[p]);
+            float depthScale = settings.depthSigma * depthGradient[p] * step;
+            bool pMiss = normal[p].length_squared() == 0;
+
+            Color sumColor(0, 0, 0);
+            float sumVariance = 0;
+            float sumWeight = 0;
+            for (int dy = -2; dy <= 2; dy++) {
+                int qy = y + dy * step;
+                if (qy < 0 || qy >= height)
+                    continue;
+                for (int dx = -2; dx <= 2; dx++) {
+                    int qx = x + dx * step;
+                    if (qx < 0 || qx >= width)
+                        continue;
+                    size_t q = size_t(qy) * width + qx;
+
+                    float w = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                    if (q != p) {
+                        bool qMiss = normal[q].length_squared() == 0;
+                        if (pMiss != qMiss)
+                            continue;
+                        if (!pMiss) {
+                            w *= std::pow(std::fmax(0.0f, dot(normal[p], normal[q])), settings.normalPower);
+                            float offset = std::sqrt(float(dx * dx + dy * dy));
+                            w *= std::exp(-std::fabs(depth[p] - depth[q]) / (depthScale * offset + 1e-3f));
+                        }
+                        // Scaled by the standard deviation of the difference, so the weight is
+                        // symmetric and a bright pixel gives as much to a dark one as it takes.
+                        float colorScale = settings.colorSigma * std::sqrt(blurredVariance[p] + blurredVariance[q]) + 1e-4f;
+                        w *= std::exp(-std::fabs(lp - luminance(color[q])) / colorScale);
+                    }
+
+                    sumColor += w * color[q];
+                    sumVariance += w * w * variance[q];
+                    sumWeight += w;
+                }
+            }
+
+            outColor[p] = sumColor / sumWeight;
+            outVariance[p] = sumVariance / (sumWeight * sumWeight);
+        }
+};
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "common.h"
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// A coordinator process hands numbered tasks (tiles) to forked worker processes over Unix
+// socket pairs and merges their float results. Workers are forks of the coordinator, so they
+// start with its scene and BVH already in memory and nothing but task numbers and results goes
+// over the sockets. A worker that dies, or holds a task past taskTimeout, is replaced and its
+// task handed out again; a task that fails maxAttempts times fails the render.
+
+class DistributedSettings {
+    public:
+        unsigned workers = 0;       // Worker processes (0: one per hardware thread)
+        int maxAttempts = 3;        // Per task
+        double taskTimeout = 0;     // Seconds before a worker is presumed hung; 0 waits forever
+};
+
+class TileResult {
+    public:
+        std::vector<float> values;
+        uint64_t rays = 0;
+};
+
+#ifdef __linux__
+
+class TileWorker {
+    public:
+        pid_t pid = -1;
+        int fd = -1;                // Coordinator's end of the socket pair
+        long task = -1;             // In flight, or -1
+        std::chrono::steady_clock::time_point taskStart;
+};
+
+class TileResultHeader {
+    public:
+        uint32_t task;
+        uint32_t valueCount;
+        uint64_t rays;
+};
+
+inline bool send_all(int fd, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        size -= size_t(sent);
+    }
+    return true;
+}
+
+inline bool receive_all(int fd, void* data, size_t size)
+{
+    char* bytes = static_cast<char*>(data);
+    while (size > 0)
+    {
+        ssize_t received = recv(fd, bytes, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        bytes += received;
+        size -= size_t(received);
+    }
+    return true;
+}
+
+[[noreturn]] inline void tile_worker_main(int fd, const std::function<void(size_t, TileResult&)>& work)
+{
+    // Renders tasks until the coordinator closes its end. _exit() skips the destructors and
+    // exit handlers this process inherited from the coordinator.
+    uint32_t task;
+    while (receive_all(fd, &task, sizeof(task)))
+    {
+        TileResult result;
+        work(task, result);
+        TileResultHeader header = { task, uint32_t(result.values.size()), result.rays };
+        if (!send_all(fd, &header, sizeof(header)) ||
+            !send_all(fd, result.values.data(), result.values.size() * sizeof(float)))
+            break;
+    }
+    _exit(0);
+}
+
+inline bool spawn_tile_worker(TileWorker& worker, const std::vector<TileWorker>& others,
+                              const std::function<void(size_t, TileResult&)>& work)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        std::cerr << "ERROR: Could not create a worker socket: " << std::strerror(errno) << ".\n";
+        return false;
+    }
+    std::cout.flush();
+    std::clog.flush();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        std::cerr << "ERROR: Could not fork a worker: " << std::strerror(errno) << ".\n";
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        for (const TileWorker& other : others)
+            if (other.fd >= 0)
+                close(other.fd);
+        tile_worker_main(fds[1], work);
+    }
+    close(fds[1]);
+    worker = TileWorker();
+    worker.pid = pid;
+    worker.fd = fds[0];
+    return true;
+}
+
+inline void stop_tile_worker(TileWorker& worker, bool kill)
+{
+    if (worker.fd < 0)
+        return;
+    if (kill)
+        ::kill(worker.pid, SIGKILL);
+    close(worker.fd);
+    waitpid(worker.pid, nullptr, 0);
+    worker.fd = -1;
+    worker.task = -1;
+}
+
+inline bool run_tile_workers(size_t taskCount, const DistributedSettings& settings,
+                             const std::function<void(size_t, TileResult&)>& work,
+                             const std::function<void(size_t, const TileResult&)>& merge)
+{
+    // Runs work(task, result) for every task in [0, taskCount) in worker processes and
+    // merge(task, result) on each result in this one. Returns false if a task failed
+    // settings.maxAttempts times or no worker could be started.
+    TRACE_SCOPE("distributed render", "render", "tasks", int64_t(taskCount));
+    std::deque<size_t> pending;
+    for (size_t t = 0; t < taskCount; t++)
+        pending.push_back(t);
+    std::vector<int> attempts(taskCount, 0);
+    size_t done = 0;
+
+    unsigned workerCount = unsigned(std::min<size_t>(resolve_thread_count(settings.workers), std::max<size_t>(taskCount, 1)));
+    std::vector<TileWorker> workers;
+    for (unsigned w = 0; w < workerCount; w++)
+    {
+        TileWorker worker;
+        if (spawn_tile_worker(worker, workers, work))
+            workers.push_back(worker);
+    }
+
+    bool failed = false;
+    auto retire = [&](TileWorker& worker, const char* reason) {
+        // Gives the worker's task to another and starts a replacement in its place.
+        long task = worker.task;
+        std::clog << "\nWorker " << worker.pid << " " << reason;
+        stop_tile_worker(worker, true);
+        if (task >= 0)
+        {
+            std::clog << " on tile " << task;
+            if (++attempts[task] >= settings.maxAttempts)
+            {
+                std::cerr << "\nERROR: Tile " << task << " failed " << attempts[task] << " times.\n";
+                failed = true;
+                return;
+            }
+            pending.push_front(size_t(task));
+        }
+        std::clog << "; restarting it." << std::endl;
+        TileWorker replacement;
+        if (spawn_tile_worker(replacement, workers, work))
+            worker = replacement;
+    };
+
+    while (done < taskCount && !failed)
+    {
+        std::vector<pollfd> polled;
+        std::vector<size_t> polledWorkers;
+        for (size_t w = 0; w < workers.size() && !failed; w++)
+        {
+            TileWorker& worker = workers[w];
+            if (worker.fd < 0)
+                continue;
+            if (worker.task < 0 && !pending.empty())
+            {
+                uint32_t task = uint32_t(pending.front());
+                pending.pop_front();
+                worker.task = task;
+                worker.taskStart = std::chrono::steady_clock::now();
+                if (!send_all(worker.fd, &task, sizeof(task)))
+                {
+                    retire(worker, "could not take a task");
+                    continue;
+                }
+            }
+            if (worker.task >= 0)
+            {
+                polled.push_back({ worker.fd, POLLIN, 0 });
+                polledWorkers.push_back(w);
+            }
+        }
+        if (failed)
+            break;
+        if (polled.empty())
+        {
+            std::cerr << "ERROR: No worker processes left with " << (taskCount - done) << " tiles to render.\n";
+            failed = true;
+            break;
+        }
+
+        int ready = poll(polled.data(), polled.size(), settings.taskTimeout > 0 ? 100 : -1);
+        if (ready < 0 && errno != EINTR)
+        {
+            std::cerr << "ERROR: poll failed: " << std::strerror(errno) << ".\n";
+            failed = true;
+            break;
+        }
+        for (size_t p = 0; p < polled.size() && !failed; p++)
+        {
+            TileWorker& worker = workers[polledWorkers[p]];
+            if (polled[p].revents == 0)
+            {
+                double held = std::chrono::duration<double>(std::chrono::steady_clock::now() - worker.taskStart).count();
+                if (settings.taskTimeout > 0 && held > settings.taskTimeout)
+                    retire(worker, "timed out");
+                continue;
+            }
+            TileResultHeader header;
+            TileResult result;
+            bool received = receive_all(worker.fd, &header, sizeof(header)) && long(header.task) == worker.task;
+            if (received)
+            {
+                result.values.resize(header.valueCount);
+                result.rays = header.rays;
+                received = receive_all(worker.fd, result.values.data(), result.values.size() * sizeof(float));
+            }
+            if (!received)
+            {
+                retire(worker, "died");
+                continue;
+            }
+            merge(header.task, result);
+            worker.task = -1;
+            done++;
+        }
+    }
+
+    for (TileWorker& worker : workers)
+        stop_tile_worker(worker, failed);
+    return !failed;
+}
+
+#else
+
+inline bool run_tile_workers([[maybe_unused]] size_t taskCount, [[maybe_unused]] const DistributedSettings& settings,
+                             [[maybe_unused]] const std::function<void(size_t, TileResult&)>& work,
+                             [[maybe_unused]] const std::function<void(size_t, const TileResult&)>& merge)
+{
+    std::cerr << "ERROR: Worker processes are only supported on Linux.\n";
+    return false;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef DYNAMIC_BVH_H
+#define DYNAMIC_BVH_H
+
+#include "common.h"
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+
+#include <vector>
+
+class DynamicBVH : public Hittable
+{
+    // A BVH that objects can be inserted into, removed from and moved within one at a time,
+    // for scenes edited interactively. Each edit touches only the path from the object's leaf
+    // to the root, so it costs time in the tree's depth rather than its size: an insert descends
+    // towards the sibling that adds the least surface area, and the ancestors of every edit are
+    // refit and rotated locally where swapping a child with a grandchild shrinks them (as in
+    // Box2D's dynamic tree). Traversal is somewhat slower than a BVHNode built over the same
+    // objects at once, which remains the choice for static scenes.
+    //
+    // Edits must not overlap rendering. Handles are the objects' leaves, valid until removed.
+public:
+    int insert(shared_ptr<Hittable> object)
+    {
+        int leaf = allocate();
+        nodes[leaf].object = object;
+        nodes[leaf].box = object->bounding_box();
+        attach(leaf);
+        leafCount++;
+        return leaf;
+    }
+
+    bool remove(int handle)
+    {
+        if (!is_valid(handle))
+        {
+            std::cerr << "ERROR: DynamicBVH::remove of an unknown handle " << handle << ".\n";
+            return false;
+        }
+        detach(handle);
+        nodes[handle].object.reset();
+        release(handle);
+        leafCount--;
+        // Threads may still hold the removed object as their last occluder (see OccluderCache);
+        // a new generation sends them back to the tree.
+        generation = nextTreeGeneration++;
+        return true;
+    }
+
+    bool update(int handle)
+    {
+        // Moves the object's leaf to fit its current bounding box, after it has moved.
+        if (!is_valid(handle))
+        {
+            std::cerr << "ERROR: DynamicBVH::update of an unknown handle " << handle << ".\n";
+            return false;
+        }
+        AABB box = nodes[handle].object->bounding_box();
+        if (box == nodes[handle].box)
+            return true;
+        detach(handle);
+        nodes[handle].box = box;
+        attach(handle);
+        return true;
+    }
+
+    size_t size() const { return leafCount; }
+
+    AABB bounding_box() const override { return root == nullIndex ? AABB::empty : nodes[root].box; }
+
+    bool hit(const Ray &r, Interval rayT, HitRecord &rec) const override
+    {
+        return root != nullIndex && hit_node(root, r, rayT, rec);
+    }
+
+    bool occluded(const Ray &r, Interval rayT) const override
+    {
+        OccluderCache& cache = thread_occluder_cache();
+        if (cache.root == this && cache.generation == generation && cache.occluder->occluded(r, rayT))
+        {
+            STAT_INC(STAT_OCCLUDER_CACHE_HITS);
+            return true;
+        }
+
+        const Hittable* occluder = nullptr;
+        if (root == nullIndex || !occluded_node(root, r, rayT, occluder))
+            return false;
+        cache.root = this;
+        cache.generation = generation;
+        cache.occluder = occluder;
+        return true;
+    }
+
+    void hit_packet(RayPacket& packet, HitRecord* recs, uint64_t active) const override
+    {
+        if (root != nullIndex)
+            hit_packet_node(root, packet, recs, active);
+    }
+
+private:
+    static constexpr int nullIndex = -1;
+
+    class Node {
+        public:
+            AABB box;
+            int parent = nullIndex;     // The next free node, while on the free list
+            int left = nullIndex;       // nullIndex in leaves
+            int right = nullIndex;
+            shared_ptr<Hittable> object;
+
+            bool is_leaf() const { return left == nullIndex; }
+    };
+
+    std::vector<Node> nodes;
+    int root = nullIndex;
+    int freeList = nullIndex;
+    uint64_t generation = nextTreeGeneration++;     // See OccluderCache
+    size_t leafCount = 0;
+
+    int allocate()
+    {
+        if (freeList == nullIndex)
+        {
+            nodes.emplace_back();
+            return int(nodes.size()) - 1;
+        }
+        int index = freeList;
+        freeList = nodes[index].parent;
+        nodes[index] = Node();
+        return index;
+    }
+
+    void release(int index)
+    {
+        nodes[index].left = nodes[index].right = nullIndex;
+        nodes[index].box = AABB::empty;
+        nodes[index].parent = freeList;
+        freeList = index;
+    }
+
+    bool is_valid(int handle) const
+    {
+        return handle >= 0 && handle < int(nodes.size()) && nodes[handle].is_leaf() && nodes[handle].object;
+    }
+
+    void attach(int leaf)
+    {
+        if (root == nullIndex)
+        {
+            root = leaf;
+            nodes[leaf].parent = nullIndex;
+            return;
+        }
+
+        // Descend while a child would take the leaf for less than pairing it with this node,
+        // counting the area every ancestor grows by on the way.
+        const AABB box = nodes[leaf].box;
+        int index = root;
+        while (!nodes[index].is_leaf())
+        {
+            float area = nodes[index].box.surface_area();
+            float combinedArea = AABB(nodes[index].box, box).surface_area();
+            float cost = 2 * combinedArea;
+            float inheritedCost = 2 * (combinedArea - area);
+            float leftCost = descent_cost(nodes[index].left, box) + inheritedCost;
+            float rightCost = descent_cost(nodes[index].right, box) + inheritedCost;
+            if (cost < leftCost && cost < rightCost)
+                break;
+            index = leftCost < rightCost ? nodes[index].left : nodes[index].right;
+        }
+
+        int sibling = index;
+        int oldParent = nodes[sibling].parent;
+        int parent = allocate();
+        nodes[parent].parent = oldParent;
+        nodes[parent].left = sibling;
+        nodes[parent].right = leaf;
+        nodes[parent].box = AABB(nodes[sibling].box, box);
+        nodes[sibling].parent = parent;
+        nodes[leaf].parent = parent;
+        if (oldParent == nullIndex)
+            root = parent;
+        else if (nodes[oldParent].left == sibling)
+            nodes[oldParent].left = parent;
+        else
+            nodes[oldParent].right = parent;
+
+        refit_ancestors(oldParent);
+    }
+
+    void detach(int leaf)
+    {
+        int parent = nodes[leaf].parent;
+        if (parent == nullIndex)
+        {
+            root = nullIndex;
+            return;
+        }
+
+        int grandParent = nodes[parent].parent;
+        int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+        nodes[sibling].parent = grandParent;
+        if (grandParent == nullIndex)
+            root = sibling;
+        else if (nodes[grandParent].left == parent)
+            nodes[grandParent].left = sibling;
+        else
+            nodes[grandParent].right = sibling;
+        release(parent);
+        nodes[leaf].parent = nullIndex;
+
+        refit_ancestors(grandParent);
+    }
+
+    float descent_cost(int child, const AABB& box) const
+    {
+        // Area the subtree under `child` grows by when it takes the box (all of the new parent's,
+        // at a leaf).
+        float combinedArea = AABB(nodes[child].box, box).surface_area();
+        if (nodes[child].is_leaf())
+            return combinedArea;
+        return combinedArea - nodes[child].box.surface_area();
+    }
+
+    void refit_ancestors(int index)
+    {
+        for (; index != nullIndex; index = nodes[index].parent)
+        {
+            rotate(index);
+            nodes[index].box = AABB(nodes[nodes[index].left].box, nodes[nodes[index].right].box);
+        }
+    }
+
+    void rotate(int index)
+    {
+        // Swaps one child of the node with a grandchild under the other child, where that
+        // shrinks the other child most; the node's own bounds stay the same.
+        int left = nodes[index].left;
+        int right = nodes[index].right;
+        float bestArea = 0;
+        int bestChild = nullIndex;
+        int bestGrandChild = nullIndex;
+        auto consider = [&](int child, int other) {
+            if (nodes[other].is_leaf())
+                return;
+            int first = nodes[other].left;
+            int second = nodes[other].right;
+            float area = nodes[other].box.surface_area();
+            float firstSwapped = AABB(nodes[child].box, nodes[second].box).surface_area();
+            float secondSwapped = AABB(nodes[child].box, nodes[first].box).surface_area();
+            if (area - firstSwapped > bestArea)
+            {
+                bestArea = area - firstSwapped;
+                bestChild = child;
+                bestGrandChild = first;
+            }
+            if (area - secondSwapped > bestArea)
+            {
+                bestArea = area - secondSwapped;
+                bestChild = child;
+                bestGrandChild = second;
+            }
+        };
+        consider(left, right);
+        consider(right, left);
+        if (bestChild == nullIndex)
+            return;
+
+        int other = nodes[bestGrandChild].parent;
+        if (nodes[index].left == bestChild)
+            nodes[index].left = bestGrandChild;
+        else
+            nodes[index].right = bestGrandChild;
+        if (nodes[other].left == bestGrandChild)
+            nodes[other].left = bestChild;
+        else
+            nodes[other].right = bestChild;
+        nodes[bestGrandChild].parent = index;
+        nodes[bestChild].parent = other;
+        nodes[other].box = AABB(nodes[nodes[other].left].box, nodes[nodes[other].right].box);
+    }
+
+    bool hit_node(int index, const Ray &r, Interval rayT, HitRecord &rec) const
+    {
+        const Node& node = nodes[index];
+        if (node.is_leaf())
+            return node.object->hit(r, rayT, rec);
+        STAT_INC(STAT_BVH_NODES);
+        if (!node.box.hit(r, rayT))
+            return false;
+
+        bool hitLeft = hit_node(node.left, r, rayT, rec);
+        bool hitRight = hit_node(node.right, r, Interval(rayT.min, hitLeft ? rec.t : rayT.max), rec);
+        return hitLeft || hitRight;
+    }
+
+    bool occluded_node(int index, const Ray &r, Interval rayT, const Hittable*& occluder) const
+    {
+        const Node& node = nodes[index];
+        if (node.is_leaf())
+        {
+            if (!node.object->occluded(r, rayT))
+                return false;
+            occluder = node.object.get();
+            return true;
+        }
+        STAT_INC(STAT_BVH_NODES);
+        if (!node.box.hit(r, rayT))
+            return false;
+        return occluded_node(node.left, r, rayT, occluder) || occluded_node(node.right, r, rayT, occluder);
+    }
+
+    void hit_packet_node(int index, RayPacket& packet, HitRecord* recs, uint64_t active) const
+    {
+        const Node& node = nodes[index];
+        if (node.is_leaf())
+        {
+            node.object->hit_packet(packet, recs, active);
+            return;
+        }
+        STAT_INC(STAT_BVH_NODES);
+        if (!packet.may_hit(node.box))
+            return;
+        active = packet.rays_hitting(active, node.box);
+        if (!active)
+            return;
+        hit_packet_node(node.left, packet, recs, active);
+        hit_packet_node(node.right, packet, recs, active);
+    }
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include "common.h"
+
+#include "image_io.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Per-pixel render cost: BVH nodes visited, primitives tested and wall time spent on each
+// pixel's samples. Node and primitive counts come from the render statistics counters, so they
+// read zero when statistics are compiled out; the time is always recorded.
+
+class CostHeatmap {
+    public:
+        void resize(int w, int h) {
+            width = w;
+            height = h;
+            nodes.assign(size_t(w) * h, 0.0f);
+            primitives.assign(size_t(w) * h, 0.0f);
+            nanoseconds.assign(size_t(w) * h, 0.0f);
+        }
+
+        class PixelStart {
+            public:
+                uint64_t nodes;
+                uint64_t primitives;
+                std::chrono::steady_clock::time_point time;
+        };
+
+        // Call both on the thread that renders the pixel; pixels may be recorded concurrently.
+        PixelStart begin_pixel() const {
+            return PixelStart{ threadStats.counters[STAT_BVH_NODES], primitive_tests(), std::chrono::steady_clock::now() };
+        }
+
+        void end_pixel(int i, int j, const PixelStart& start) {
+            auto end = std::chrono::steady_clock::now();
+            size_t n = size_t(j) * width + i;
+            nanoseconds[n] = float(std::chrono::duration<double, std::nano>(end - start.time).count());
+            nodes[n] = float(threadStats.counters[STAT_BVH_NODES] - start.nodes);
+            primitives[n] = float(primitive_tests() - start.primitives);
+        }
+
+        void write(const std::string& filename) const {
+            // Writes <filename>.cost_<metric>.pfm with the raw values and
+            // <filename>.cost_<metric>.ppm as a false-color image scaled to the 99th percentile.
+            write_metric(filename + ".cost_nodes", nodes);
+            write_metric(filename + ".cost_primitives", primitives);
+            write_metric(filename + ".cost_time", nanoseconds);
+        }
+
+    private:
+        int width = 0;
+        int height = 0;
+        std::vector<float> nodes;
+        std::vector<float> primitives;
+        std::vector<float> nanoseconds;
+
+        static uint64_t primitive_tests() {
+            const uint64_t* c = threadStats.counters;
+            return c[STAT_TEST_SPHERE] + c[STAT_TEST_QUAD] + c[STAT_TEST_TRIANGLE] + c[STAT_TEST_ELLIPSE] + c[STAT_TEST_MEDIUM] + c[STAT_TEST_BOX];
+        }
+
+        static Color false_color(float t) {
+            // Black -> blue -> magenta -> orange -> yellow -> white.
+            static const Color ramp[] = {
+                Color(0.0, 0.0, 0.0), Color(0.1, 0.1, 0.6), Color(0.7, 0.1, 0.6),
+                Color(1.0, 0.5, 0.1), Color(1.0, 0.9, 0.2), Color(1.0, 1.0, 1.0),
+            };
+            const int last = int(sizeof(ramp) / sizeof(ramp[0])) - 1;
+
+            t = Interval(0, 1).clamp(t) * last;
+            int k = std::min(int(t), last - 1);
+            float f = t - k;
+            return (1 - f) * ramp[k] + f * ramp[k + 1];
+        }
+
+        void write_metric(const std::string& base, const std::vector<float>& values) const {
+            write_pfm_gray(base + ".pfm", values, width, height);
+
+            std::vector<float> sorted(values);
+            size_t p99 = sorted.empty() ? 0 : (sorted.size() - 1) * 99 / 100;
+            std::nth_element(sorted.begin(), sorted.begin() + p99, sorted.end());
+            float scale = (sorted.empty() || sorted[p99] <= 0) ? 0.0f : 1.0f / sorted[p99];
+
+            // write_ppm() gamma-encodes with a square root, so square the ramp colors to keep
+            // them as designed.
+            std::vector<Color> image(values.size());
+            for (size_t n = 0; n < values.size(); n++) {
+                Color c = false_color(values[n] * scale);
+                image[n] = c * c;
+            }
+            write_ppm(base + ".ppm", image, width, height);
+        }
+};
+
+#endif
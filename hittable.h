@@ -4,9 +4,13 @@
 #include "common.h"
 
 #include "aabb.h"
+#include "packet.h"
+#include "transform.h"
 
+#include <atomic>
 
 class Material;
+class HittableList;
 
 class HitRecord {
     public: 
@@ -17,6 +21,7 @@ class HitRecord {
         float u;
         float v;
         bool frontFace;
+        uint32_t objectId = 0;
 
     void set_face_normal(const Ray& r, const Vector3& outwardNormal) {
         frontFace = dot(r.direction(), outwardNormal) < 0;
@@ -24,11 +29,52 @@ class HitRecord {
     }
 };
 
+inline std::atomic<uint32_t> nextObjectId{1};
+
 class Hittable {
     public:
+        // Reported by primitives in HitRecord::objectId; assigned in construction order, so a
+        // scene built the same way numbers its objects the same way. 0 means no object.
+        uint32_t objectId = nextObjectId++;
+
         virtual ~Hittable() = default;
         virtual bool hit(const Ray& r, Interval rayT, HitRecord& rec) const = 0;
         virtual AABB bounding_box() const = 0;
+
+        virtual AABB bounding_box_at([[maybe_unused]] float time) const {
+            // Bounds of the object at one time in [0, 1]; bounding_box() covers the whole
+            // shutter interval. Only moving objects need to override this.
+            return bounding_box();
+        }
+
+        virtual bool occluded(const Ray& r, Interval rayT) const {
+            // Whether anything is hit within rayT: an any-hit query for visibility tests, which
+            // need neither the closest hit nor its attributes. Overrides skip both.
+            HitRecord rec;
+            return hit(r, rayT, rec);
+        }
+
+        virtual void hit_packet(RayPacket& packet, HitRecord* recs, uint64_t active) const {
+            // Closest hits of the packet's rays in the `active` mask, shortening packet.tMax and
+            // filling recs as they are found. Anything that is not an aggregate traces ray by ray.
+            for (; active; active &= active - 1) {
+                int i = RayPacket::lowest_bit(active);
+                if (hit(packet.rays[i], Interval(packet.tMin, packet.tMax[i]), recs[i])) {
+                    packet.tMax[i] = recs[i].t;
+                    packet.hit[i] = true;
+                }
+            }
+        }
+
+        virtual bool bake([[maybe_unused]] const Transform& xf, [[maybe_unused]] HittableList& out) const {
+            // Appends world-space copies of this object's primitives, placed by xf, so that a
+            // static Translate/Rotate chain can be replaced by geometry that needs no per-ray
+            // transform. Returns false if the object cannot be baked, in which case out may hold
+            // part of it and should be discarded. Copies keep their source's objectId.
+            return false;
+        }
+
+        virtual bool is_transform() const { return false; }
 };
 
 class Translate : public Hittable {
@@ -40,6 +86,8 @@ class Translate : public Hittable {
 
     AABB bounding_box() const override { return bbox; }
 
+    AABB bounding_box_at(float time) const override { return object->bounding_box_at(time) + offset; }
+
     bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
         Ray offset_r(r.origin() - offset, r.direction(), r.time());
 
@@ -52,6 +100,17 @@ class Translate : public Hittable {
         return true;
     }
 
+    bool occluded(const Ray& r, Interval rayT) const override {
+        return object->occluded(Ray(r.origin() - offset, r.direction(), r.time()), rayT);
+    }
+
+    bool bake(const Transform& xf, HittableList& out) const override {
+        // An object shared with another wrapper is an instance, and stays one.
+        return object.use_count() == 1 && object->bake(xf * Transform::translation(offset), out);
+    }
+
+    bool is_transform() const override { return true; }
+
   private:
     shared_ptr<Hittable> object;
     Vector3 offset;
@@ -100,7 +159,7 @@ RotateX(shared_ptr<Hittable> object, float angle) : object(object) {
     bbox = AABB(min, max);
 }
 
-bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
+Ray to_object_space(const Ray& r) const {
     // Change the ray from world space to object space
     Vector3 origin = r.origin();
     Vector3 direction = r.direction();
@@ -111,7 +170,11 @@ bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
     direction[1] =  cosTheta*r.direction()[1] + sinTheta*r.direction()[2];
     direction[2] = -sinTheta*r.direction()[1] + cosTheta*r.direction()[2];
 
-    Ray rotated_r(origin, direction, r.time());
+    return Ray(origin, direction, r.time());
+}
+
+bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
+    Ray rotated_r = to_object_space(r);
 
     // Determine whether an intersection exists in object space (and if so, where)
     if (!object->hit(rotated_r, rayT, rec))
@@ -133,6 +196,16 @@ bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
     return true;
 }
 
+bool occluded(const Ray& r, Interval rayT) const override {
+    return object->occluded(to_object_space(r), rayT);
+}
+
+bool bake(const Transform& xf, HittableList& out) const override {
+    return object.use_count() == 1 && object->bake(xf * Transform::rotation_x(sinTheta, cosTheta), out);
+}
+
+bool is_transform() const override { return true; }
+
 AABB bounding_box() const override { return bbox; }
 
 private:
@@ -176,7 +249,7 @@ RotateY(shared_ptr<Hittable> object, float angle) : object(object) {
     bbox = AABB(min, max);
 }
 
-bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
+Ray to_object_space(const Ray& r) const {
     // Change the ray from world space to object space
     Vector3 origin = r.origin();
     Vector3 direction = r.direction();
@@ -187,7 +260,11 @@ bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
     direction[0] = cosTheta*r.direction()[0] - sinTheta*r.direction()[2];
     direction[2] = sinTheta*r.direction()[0] + cosTheta*r.direction()[2];
 
-    Ray rotated_r(origin, direction, r.time());
+    return Ray(origin, direction, r.time());
+}
+
+bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
+    Ray rotated_r = to_object_space(r);
 
     // Determine whether an intersection exists in object space (and if so, where)
     if (!object->hit(rotated_r, rayT, rec))
@@ -209,6 +286,16 @@ bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
     return true;
 }
 
+bool occluded(const Ray& r, Interval rayT) const override {
+    return object->occluded(to_object_space(r), rayT);
+}
+
+bool bake(const Transform& xf, HittableList& out) const override {
+    return object.use_count() == 1 && object->bake(xf * Transform::rotation_y(sinTheta, cosTheta), out);
+}
+
+bool is_transform() const override { return true; }
+
 AABB bounding_box() const override { return bbox; }
 
 private:
@@ -252,7 +339,7 @@ RotateZ(shared_ptr<Hittable> object, float angle) : object(object) {
     bbox = AABB(min, max);
 }
 
-bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
+Ray to_object_space(const Ray& r) const {
     // Change the ray from world space to object space
     Vector3 origin = r.origin();
     Vector3 direction = r.direction();
@@ -263,7 +350,11 @@ bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
     direction[0] =  cosTheta*r.direction()[0] + sinTheta*r.direction()[1];
     direction[1] = -sinTheta*r.direction()[0] + cosTheta*r.direction()[1];
 
-    Ray rotated_r(origin, direction, r.time());
+    return Ray(origin, direction, r.time());
+}
+
+bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
+    Ray rotated_r = to_object_space(r);
 
     // Determine whether an intersection exists in object space (and if so, where)
     if (!object->hit(rotated_r, rayT, rec))
@@ -285,6 +376,16 @@ bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
     return true;
 }
 
+bool occluded(const Ray& r, Interval rayT) const override {
+    return object->occluded(to_object_space(r), rayT);
+}
+
+bool bake(const Transform& xf, HittableList& out) const override {
+    return object.use_count() == 1 && object->bake(xf * Transform::rotation_z(sinTheta, cosTheta), out);
+}
+
+bool is_transform() const override { return true; }
+
 AABB bounding_box() const override { return bbox; }
 
 private:
@@ -1,6 +1,7 @@
 #ifndef HITTABLE_LIST_H
 #define HITTABLE_LIST_H
 
+#include <algorithm>
 #include <vector>
 
 #include "common.h"
@@ -14,7 +15,20 @@ public:
     HittableList() {}
     HittableList(shared_ptr<Hittable> obj) { add(obj); }
 
-    void clear() { objs.clear(); }
+    void clear() { objs.clear(); bbox = AABB(); }
+
+    bool remove(const shared_ptr<Hittable>& obj)
+    {
+        // Linear in the list's size; DynamicBVH takes objects out of a tree in logarithmic time.
+        auto found = std::find(objs.begin(), objs.end(), obj);
+        if (found == objs.end())
+            return false;
+        objs.erase(found);
+        bbox = AABB();
+        for (const shared_ptr<Hittable> &other : objs)
+            bbox = AABB(bbox, other->bounding_box());
+        return true;
+    }
 
     AABB bounding_box() const override { return bbox; }
 
@@ -42,8 +56,50 @@ public:
         return hitAnything;
     }
 
+    bool occluded(const Ray &r, Interval rayT) const override
+    {
+        for (const shared_ptr<Hittable> &obj : objs)
+            if (obj->occluded(r, rayT))
+                return true;
+        return false;
+    }
+
+    void hit_packet(RayPacket& packet, HitRecord* recs, uint64_t active) const override
+    {
+        for (const shared_ptr<Hittable> &obj : objs)
+            obj->hit_packet(packet, recs, active);
+    }
+
+    bool bake(const Transform& xf, HittableList& out) const override
+    {
+        for (const shared_ptr<Hittable> &obj : objs)
+            if (!obj->bake(xf, out))
+                return false;
+        return true;
+    }
+
 private:
     AABB bbox;
 };
 
+inline HittableList bake_transforms(const HittableList& world)
+{
+    // The world with every top-level Translate/Rotate chain replaced by the world-space
+    // primitives it places, where the whole chain can be baked, so the BVH is built over the
+    // primitives themselves and rays skip the per-object transforms. Chains over instanced or
+    // unbakeable objects are kept as they are.
+    TRACE_SCOPE("bake transforms", "bvh");
+    HittableList baked;
+    for (const shared_ptr<Hittable> &obj : world.objs)
+    {
+        HittableList primitives;
+        if (obj->is_transform() && obj->bake(Transform(), primitives))
+            for (const shared_ptr<Hittable> &primitive : primitives.objs)
+                baked.add(primitive);
+        else
+            baked.add(obj);
+    }
+    return baked;
+}
+
 #endif
\ No newline at end of file
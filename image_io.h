@@ -0,0 +1,274 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include "common.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Image buffers are row-major, top row first.
+
+inline std::string insert_suffix(const std::string& filename, const std::string& suffix)
+{
+    // "out.ppm" with suffix "0001" is "out.0001.ppm"; a name without an extension gets
+    // ".0001" appended.
+    size_t dot = filename.rfind('.');
+    if (dot == std::string::npos || filename.find('/', dot) != std::string::npos)
+        dot = filename.size();
+    return filename.substr(0, dot) + '.' + suffix + filename.substr(dot);
+}
+
+inline void write_ppm(std::ostream& out, const std::vector<Color>& pixels, int width, int height, float scale = 1.0f)
+{
+    // Gamma-corrected 8-bit ASCII PPM, each pixel multiplied by `scale` first.
+    out << "P3\n" << width << ' ' << height << "\n255\n";
+    for (size_t n = 0; n < size_t(width) * height; n++)
+        write_color(out, scale * pixels[n]);
+}
+
+inline bool write_ppm(const std::string& filename, const std::vector<Color>& pixels, int width, int height, float scale = 1.0f)
+{
+    std::ofstream ofs(filename, std::ios::binary);
+    if (!ofs) {
+        std::cerr << "ERROR: Could not write image file '" << filename << "'.\n";
+        return false;
+    }
+    write_ppm(ofs, pixels, width, height, scale);
+    return bool(ofs);
+}
+
+inline bool write_pfm(const std::string& filename, const std::vector<Color>& pixels, int width, int height, float scale = 1.0f)
+{
+    // Writes linear little-endian RGB PFM. PFM stores the bottom row first.
+    std::ofstream ofs(filename, std::ios::binary);
+    if (!ofs) {
+        std::cerr << "ERROR: Could not write image file '" << filename << "'.\n";
+        return false;
+    }
+
+    ofs << "PF\n" << width << ' ' << height << "\n-1.0\n";
+    std::vector<float> row(size_t(width) * 3);
+    for (int j = height - 1; j >= 0; j--) {
+        for (int i = 0; i < width; i++) {
+            const Color& c = pixels[size_t(j) * width + i];
+            row[3*i + 0] = scale * c.x();
+            row[3*i + 1] = scale * c.y();
+            row[3*i + 2] = scale * c.z();
+        }
+        ofs.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+    }
+    return bool(ofs);
+}
+
+inline bool write_pfm_gray(const std::string& filename, const std::vector<float>& values, int width, int height)
+{
+    // Writes a single-channel linear little-endian PFM, bottom row first.
+    std::ofstream ofs(filename, std::ios::binary);
+    if (!ofs) {
+        std::cerr << "ERROR: Could not write image file '" << filename << "'.\n";
+        return false;
+    }
+
+    ofs << "Pf\n" << width << ' ' << height << "\n-1.0\n";
+    for (int j = height - 1; j >= 0; j--)
+        ofs.write(reinterpret_cast<const char*>(values.data() + size_t(j) * width), size_t(width) * sizeof(float));
+    return bool(ofs);
+}
+
+class ImageRowWriter {
+    // Writes an image a few rows at a time, so that images too large to hold in memory can be
+    // written as they are rendered: a binary (P6) PPM of gamma-corrected bytes, or a linear
+    // little-endian PFM when the filename ends in ".pfm". PFM stores the bottom row first, so
+    // its rows must be handed over bottom up.
+    public:
+        bool open(const std::string& filename, int imageWidth, int imageHeight, float pixelScale = 1.0f) {
+            pfm = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".pfm") == 0;
+            width = imageWidth;
+            scale = pixelScale;
+            ofs.open(filename, std::ios::binary);
+            if (!ofs) {
+                std::cerr << "ERROR: Could not write image file '" << filename << "'.\n";
+                return false;
+            }
+            if (pfm)
+                ofs << "PF\n" << imageWidth << ' ' << imageHeight << "\n-1.0\n";
+            else
+                ofs << "P6\n" << imageWidth << ' ' << imageHeight << "\n255\n";
+            return bool(ofs);
+        }
+
+        bool bottom_up() const { return pfm; }
+
+        bool write_rows(const std::vector<Color>& pixels, int rows) {
+            // Appends the `rows` rows of pixels (top row first, as always) that come next in the
+            // file: below the rows written so far, or above them when bottom_up().
+            if (pfm) {
+                std::vector<float> line(size_t(width) * 3);
+                for (int j = rows - 1; j >= 0; j--) {
+                    for (int i = 0; i < width; i++) {
+                        const Color& c = pixels[size_t(j) * width + i];
+                        line[3*i + 0] = scale * c.x();
+                        line[3*i + 1] = scale * c.y();
+                        line[3*i + 2] = scale * c.z();
+                    }
+                    ofs.write(reinterpret_cast<const char*>(line.data()), line.size() * sizeof(float));
+                }
+            }
+            else {
+                std::vector<uint8_t> line(size_t(width) * 3);
+                for (int j = 0; j < rows; j++) {
+                    for (int i = 0; i < width; i++)
+                        color_to_bytes(scale * pixels[size_t(j) * width + i], &line[3*i]);
+                    ofs.write(reinterpret_cast<const char*>(line.data()), line.size());
+                }
+            }
+            return bool(ofs);
+        }
+
+        bool close() {
+            ofs.close();
+            return bool(ofs);
+        }
+
+    private:
+        std::ofstream ofs;
+        int width = 0;
+        float scale = 1.0f;
+        bool pfm = false;
+};
+
+class ExrChannel {
+    // One channel of a multi-channel EXR: 32-bit float values read with a stride (so the three
+    // components of a Color buffer can be separate channels) and multiplied by scale, or
+    // 32-bit unsigned integers such as ids.
+    public:
+        std::string name;
+        const float* floats = nullptr;
+        const uint32_t* uints = nullptr;
+        size_t stride = 1;
+        float scale = 1.0f;
+
+        template <typename V>
+        static ExrChannel component(const std::string& name, const std::vector<V>& values, int c, float scale = 1.0f) {
+            // Channel c of a Vector3 or Color buffer.
+            static_assert(sizeof(V) == 3 * sizeof(float), "expected three packed floats");
+            ExrChannel ch;
+            ch.name = name;
+            ch.floats = reinterpret_cast<const float*>(values.data()) + c;
+            ch.stride = 3;
+            ch.scale = scale;
+            return ch;
+        }
+};
+
+inline bool write_exr(const std::string& filename, std::vector<ExrChannel> channels, int width, int height)
+{
+    // Writes an uncompressed scanline OpenEXR on a little-endian host. Readers expect the
+    // channels in name order, in the header and in each scanline.
+    std::ofstream ofs(filename, std::ios::binary);
+    if (!ofs) {
+        std::cerr << "ERROR: Could not write image file '" << filename << "'.\n";
+        return false;
+    }
+    std::sort(channels.begin(), channels.end(), [](const ExrChannel& a, const ExrChannel& b) { return a.name < b.name; });
+
+    auto put = [&ofs](const void* data, size_t size) { ofs.write(static_cast<const char*>(data), size); };
+    auto put_i32 = [&put](int32_t value) { put(&value, 4); };
+    auto put_attribute = [&](const char* name, const char* type, int32_t size) {
+        put(name, std::strlen(name) + 1);
+        put(type, std::strlen(type) + 1);
+        put_i32(size);
+    };
+
+    const unsigned char magic[4] = { 0x76, 0x2f, 0x31, 0x01 };
+    put(magic, 4);
+    put_i32(2);
+
+    int32_t chlistSize = 1;
+    for (const ExrChannel& ch : channels)
+        chlistSize += int32_t(ch.name.size()) + 1 + 16;
+    put_attribute("channels", "chlist", chlistSize);
+    for (const ExrChannel& ch : channels) {
+        put(ch.name.c_str(), ch.name.size() + 1);
+        put_i32(ch.uints ? 0 : 2);                  // UINT or FLOAT
+        const unsigned char linearAndReserved[4] = { 0, 0, 0, 0 };
+        put(linearAndReserved, 4);
+        put_i32(1);
+        put_i32(1);
+    }
+    put("", 1);
+
+    const unsigned char noCompression = 0;
+    put_attribute("compression", "compression", 1);
+    put(&noCompression, 1);
+    const int32_t window[4] = { 0, 0, width - 1, height - 1 };
+    put_attribute("dataWindow", "box2i", 16);
+    put(window, 16);
+    put_attribute("displayWindow", "box2i", 16);
+    put(window, 16);
+    const unsigned char increasingY = 0;
+    put_attribute("lineOrder", "lineOrder", 1);
+    put(&increasingY, 1);
+    const float one = 1.0f;
+    const float center[2] = { 0, 0 };
+    put_attribute("pixelAspectRatio", "float", 4);
+    put(&one, 4);
+    put_attribute("screenWindowCenter", "v2f", 8);
+    put(center, 8);
+    put_attribute("screenWindowWidth", "float", 4);
+    put(&one, 4);
+    put("", 1);
+
+    // Offset table, then one block per scanline: y, byte count, each channel's row.
+    uint64_t blockSize = 8 + uint64_t(channels.size()) * width * 4;
+    uint64_t offset = uint64_t(ofs.tellp()) + uint64_t(height) * 8;
+    for (int y = 0; y < height; y++, offset += blockSize)
+        put(&offset, 8);
+
+    std::vector<uint32_t> row(width);
+    for (int y = 0; y < height; y++) {
+        put_i32(y);
+        put_i32(int32_t(channels.size() * width * 4));
+        for (const ExrChannel& ch : channels) {
+            for (int x = 0; x < width; x++) {
+                size_t n = size_t(y) * width + x;
+                if (ch.uints) {
+                    row[x] = ch.uints[n];
+                }
+                else {
+                    float value = ch.scale * ch.floats[n * ch.stride];
+                    std::memcpy(&row[x], &value, 4);
+                }
+            }
+            put(row.data(), size_t(width) * 4);
+        }
+    }
+    return bool(ofs);
+}
+
+inline bool read_pfm(const std::string& filename, std::vector<Color>& pixels, int& width, int& height)
+{
+    // Reads an RGB PFM written by write_pfm() on a little-endian host.
+    std::ifstream ifs(filename, std::ios::binary);
+    std::string magic;
+    float byteOrder;
+    if (!(ifs >> magic >> width >> height >> byteOrder) || magic != "PF" || byteOrder >= 0 || width <= 0 || height <= 0)
+        return false;
+    ifs.get();
+
+    pixels.assign(size_t(width) * height, Color());
+    std::vector<float> row(size_t(width) * 3);
+    for (int j = height - 1; j >= 0; j--) {
+        if (!ifs.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(float)))
+            return false;
+        for (int i = 0; i < width; i++)
+            pixels[size_t(j) * width + i] = Color(row[3*i + 0], row[3*i + 1], row[3*i + 2]);
+    }
+    return true;
+}
+
+#endif
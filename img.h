@@ -13,6 +13,8 @@
 #include <cstdlib>
 #include <iostream>
 
+#include "trace.h"
+
 class Image {
   public:
     Image() {}
@@ -54,6 +56,7 @@ class Image {
         // contiguous, going left to right for the width of the image, followed by the next row
         // below, for the full height of the image.
 
+        TRACE_SCOPE("decode image", "scene");
         int n = bytes_per_pixel; // Dummy out parameter: original components per pixel
         fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
         if (fdata == nullptr) return false;
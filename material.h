@@ -3,19 +3,31 @@
 
 #include "common.h"
 
+#include "sampler.h"
 #include "texture.h"
 
+#include <atomic>
+
 class HitRecord;
 
+inline std::atomic<uint32_t> nextMaterialId{1};
+
 class Material {
     public:
+        // Identifies the material in material-id outputs, in construction order; 0 means none.
+        uint32_t materialId = nextMaterialId++;
+
         virtual ~Material() = default;
 
         virtual Color emitted([[maybe_unused]] float u, [[maybe_unused]] float v, [[maybe_unused]] const Point3& p) const {
             return Color(0,0,0);
         }
 
-        virtual bool scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered) const = 0;
+        // Random decisions draw on `sampler`, which the caller has set to this bounce's dimensions.
+        virtual bool scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const = 0;
+
+        // Surface color for auxiliary outputs and the denoiser; not used for shading.
+        virtual Color albedo(const HitRecord& rec) const = 0;
 };
 
 class Lambertian : public Material{
@@ -23,8 +35,9 @@ class Lambertian : public Material{
         Lambertian(const Color& alb): tex(make_shared<SolidColor>(alb)) {}
         Lambertian(shared_ptr<Texture> tex) : tex(tex) {}
 
-        bool scatter([[maybe_unused]] const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered) const override {
-            Vector3 scatterDirection = rec.normal + random_unit_vector();
+        bool scatter([[maybe_unused]] const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const override {
+            Vector3 uv = sampler.get_2d();
+            Vector3 scatterDirection = rec.normal + sample_unit_vector(uv.x(), uv.y());
 
             if (scatterDirection.near_zero()){
                 scatterDirection = rec.normal;
@@ -36,6 +49,10 @@ class Lambertian : public Material{
             return true;
         }
 
+        Color albedo(const HitRecord& rec) const override {
+            return tex->value(rec.u, rec.v, rec.p);
+        }
+
     private:
         shared_ptr<Texture> tex;
 };
@@ -45,15 +62,20 @@ class Metal : public Material{
         Metal(const Color& alb, float fuzz) : tex(make_shared<SolidColor>(alb)), fuzz(fuzz) {}
         Metal(shared_ptr<Texture> tex, float fuzz) : tex(tex), fuzz(fuzz) {}
 
-        bool scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered) const override {
+        bool scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const override {
+            Vector3 uv = sampler.get_2d();
             Vector3 reflected = reflect(rIn.direction(), rec.normal);
-            reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
+            reflected = unit_vector(reflected) + (fuzz * sample_unit_vector(uv.x(), uv.y()));
             scattered = Ray(rec.p, reflected, rIn.time());
             attenuation = tex->value(rec.u, rec.v, rec.p);
             return (dot(scattered.direction(), rec.normal) > 0);
 
         }
 
+        Color albedo(const HitRecord& rec) const override {
+            return tex->value(rec.u, rec.v, rec.p);
+        }
+
     private:
         shared_ptr<Texture> tex;
         float fuzz;
@@ -65,7 +87,7 @@ class Dielectric : public Material{
         Dielectric(const Color& alb, float refInd): tex(make_shared<SolidColor>(alb)), refractionIndex(refInd) {}
         Dielectric(shared_ptr<Texture> tex, float refInd): tex(tex), refractionIndex(refInd) {}
 
-        bool scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered) const override {
+        bool scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const override {
             attenuation = (Color(1.0, 1.0, 1.0) / 2) + (tex->value(rec.u, rec.v, rec.p) / 2);
             float ri = rec.frontFace ? (1.0/refractionIndex) : refractionIndex;
 
@@ -77,7 +99,7 @@ class Dielectric : public Material{
             bool cannotRefract = ri * sinTheta > 1.0;
             Vector3 direction;
 
-            if (cannotRefract || reflectance(cosTheta, ri) > random_float()){
+            if (cannotRefract || reflectance(cosTheta, ri) > sampler.get_1d()){
                 direction = reflect(unitDirection, rec.normal);
             }    
             else{
@@ -89,6 +111,10 @@ class Dielectric : public Material{
 
         }
 
+        Color albedo(const HitRecord& rec) const override {
+            return (Color(1.0, 1.0, 1.0) / 2) + (tex->value(rec.u, rec.v, rec.p) / 2);
+        }
+
     private:
         shared_ptr<Texture> tex;
         float refractionIndex;
@@ -111,10 +137,16 @@ class DiffuseLight : public Material {
         return tex->value(u, v, p);
     }
 
-    bool scatter([[maybe_unused]]const Ray& rIn, [[maybe_unused]]const HitRecord& rec, [[maybe_unused]]Color& attenuation, [[maybe_unused]]Ray& scattered) const override {
+    bool scatter([[maybe_unused]]const Ray& rIn, [[maybe_unused]]const HitRecord& rec, [[maybe_unused]]Color& attenuation, [[maybe_unused]]Ray& scattered, [[maybe_unused]]Sampler& sampler) const override {
         return false;
     }
 
+    Color albedo(const HitRecord& rec) const override {
+        // Emission clamped to [0,1], so lights keep their edges in the denoiser.
+        Color e = tex->value(rec.u, rec.v, rec.p);
+        return Color(std::fmin(e.x(), 1.0f), std::fmin(e.y(), 1.0f), std::fmin(e.z(), 1.0f));
+    }
+
   private:
     shared_ptr<Texture> tex;
 };
@@ -124,13 +156,18 @@ class Isotropic : public Material {
     Isotropic(const Color& albedo) : tex(make_shared<SolidColor>(albedo)) {}
     Isotropic(shared_ptr<Texture> tex) : tex(tex) {}
 
-    bool scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered)
+    bool scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler)
     const override {
-        scattered = Ray(rec.p, random_unit_vector(), rIn.time());
+        Vector3 uv = sampler.get_2d();
+        scattered = Ray(rec.p, sample_unit_vector(uv.x(), uv.y()), rIn.time());
         attenuation = tex->value(rec.u, rec.v, rec.p);
         return true;
     }
 
+    Color albedo(const HitRecord& rec) const override {
+        return tex->value(rec.u, rec.v, rec.p);
+    }
+
   private:
     shared_ptr<Texture> tex;
 };
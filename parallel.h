@@ -0,0 +1,43 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trace.h"
+
+inline unsigned resolve_thread_count(unsigned requested)
+{
+    // 0 means one thread per hardware thread.
+    if (requested > 0)
+        return requested;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+template <typename F>
+void parallel_for(size_t count, unsigned threads, F&& body)
+{
+    // Calls body(index, thread) for every index in [0, count) on `threads` threads, the caller
+    // being thread 0. Indices are handed out one at a time, so uneven work items balance out.
+    threads = unsigned(std::min<size_t>(std::max(1u, threads), std::max<size_t>(count, 1)));
+    std::atomic<size_t> next{0};
+    auto worker = [&](unsigned thread) {
+        trace_thread_name(thread == 0 ? "main" : "worker " + std::to_string(thread));
+        TRACE_SCOPE("worker", "thread", "thread", thread);
+        for (size_t index = next++; index < count; index = next++)
+            body(index, thread);
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++)
+        pool.emplace_back(worker, t);
+    worker(0);
+    for (std::thread& t : pool)
+        t.join();
+}
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware performance counters (Linux perf_event_open).
+//
+// Each thread opens its own counters the first time it is measured, counting user-space events
+// of that thread only. Counters that cannot be opened (no kernel support, perf_event_paranoid,
+// containers, other platforms) are reported as unavailable and everything else carries on.
+// Reading costs a system call per counter, so measurements are taken around phases and tiles,
+// not individual rays.
+
+enum PERFCOUNTER {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTER_COUNT,
+};
+
+static const char* const perfCounterNames[PERF_COUNTER_COUNT] = {
+    "cycles",
+    "instructions",
+    "l1d_read_misses",
+    "llc_read_misses",
+    "branch_misses",
+};
+
+enum PERFPHASE {
+    PERF_PHASE_BVH_BUILD = 0,
+    PERF_PHASE_RENDER,          // Traversal and shading, which interleave per ray
+    PERF_PHASE_WRITE_IMAGE,
+    PERF_PHASE_COUNT,
+};
+
+static const char* const perfPhaseNames[PERF_PHASE_COUNT] = {
+    "bvh_build",
+    "render",
+    "write_image",
+};
+
+class PerfCounterValues {
+    // Raw counts with the time each counter was enabled and actually running, so that counts
+    // of multiplexed counters can be scaled up.
+    public:
+        uint64_t value[PERF_COUNTER_COUNT] = {};
+        uint64_t enabled[PERF_COUNTER_COUNT] = {};
+        uint64_t running[PERF_COUNTER_COUNT] = {};
+
+        void add(const PerfCounterValues& other) {
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+                value[c] += other.value[c];
+                enabled[c] += other.enabled[c];
+                running[c] += other.running[c];
+            }
+        }
+
+        void add_difference(const PerfCounterValues& end, const PerfCounterValues& start) {
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+                value[c] += end.value[c] - start.value[c];
+                enabled[c] += end.enabled[c] - start.enabled[c];
+                running[c] += end.running[c] - start.running[c];
+            }
+        }
+
+        double scaled(int c) const {
+            if (running[c] == 0)
+                return 0;
+            return double(value[c]) * double(enabled[c]) / double(running[c]);
+        }
+
+        void write_json(std::ostream& out, const bool* available) const {
+            out << "{";
+            bool first = true;
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+                if (!available[c])
+                    continue;
+                out << (first ? "" : ", ") << "\"" << perfCounterNames[c] << "\": " << uint64_t(scaled(c));
+                first = false;
+            }
+            if (available[PERF_CYCLES] && available[PERF_INSTRUCTIONS] && scaled(PERF_CYCLES) > 0)
+                out << (first ? "" : ", ") << "\"ipc\": " << scaled(PERF_INSTRUCTIONS) / scaled(PERF_CYCLES);
+            out << "}";
+        }
+};
+
+class PerfCounters {
+    public:
+        PerfCounters() {
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+                fds[c] = -1;
+            open_all();
+        }
+
+        ~PerfCounters() {
+#ifdef __linux__
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+                if (fds[c] >= 0)
+                    close(fds[c]);
+#endif
+        }
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        bool available(int c) const { return fds[c] >= 0; }
+
+        bool any_available() const {
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+                if (fds[c] >= 0)
+                    return true;
+            return false;
+        }
+
+        PerfCounterValues read() const {
+            PerfCounterValues values;
+#ifdef __linux__
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+                uint64_t data[3];
+                if (fds[c] >= 0 && ::read(fds[c], data, sizeof(data)) == ssize_t(sizeof(data))) {
+                    values.value[c] = data[0];
+                    values.enabled[c] = data[1];
+                    values.running[c] = data[2];
+                }
+            }
+#endif
+            return values;
+        }
+
+    private:
+        int fds[PERF_COUNTER_COUNT];
+
+        void open_all() {
+#ifdef __linux__
+            const uint64_t l1dReadMiss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            const uint64_t llcReadMiss = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            fds[PERF_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+            fds[PERF_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+            fds[PERF_L1D_MISSES] = open_counter(PERF_TYPE_HW_CACHE, l1dReadMiss);
+            fds[PERF_LLC_MISSES] = open_counter(PERF_TYPE_HW_CACHE, llcReadMiss);
+            fds[PERF_BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+        }
+
+#ifdef __linux__
+        static int open_counter(uint32_t type, uint64_t config) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+};
+
+inline PerfCounters& thread_perf_counters()
+{
+    static thread_local PerfCounters counters;
+    return counters;
+}
+
+class PerfReport {
+    // Counter totals for one render, per phase and per render thread.
+    public:
+        PerfCounterValues phases[PERF_PHASE_COUNT];
+        std::vector<PerfCounterValues> threads;
+        bool available[PERF_COUNTER_COUNT] = {};
+
+        void note_available(const PerfCounters& counters) {
+            // Every thread opens the same counters, so one thread's set stands for all.
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+                available[c] = counters.available(c);
+        }
+
+        bool any_available() const {
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+                if (available[c])
+                    return true;
+            return false;
+        }
+
+        void write_json(std::ostream& out) const {
+            out << "{\n  \"available\": " << (any_available() ? "true" : "false") << ",\n  \"phases\": {\n";
+            for (int p = 0; p < PERF_PHASE_COUNT; p++) {
+                out << "    \"" << perfPhaseNames[p] << "\": ";
+                phases[p].write_json(out, available);
+                out << (p + 1 < PERF_PHASE_COUNT ? "," : "") << "\n";
+            }
+            out << "  },\n  \"render_threads\": [\n";
+            for (size_t t = 0; t < threads.size(); t++) {
+                out << "    ";
+                threads[t].write_json(out, available);
+                out << (t + 1 < threads.size() ? "," : "") << "\n";
+            }
+            out << "  ]\n}\n";
+        }
+
+        bool write_json(const std::string& filename) const {
+            std::ofstream ofs(filename);
+            if (!ofs)
+                return false;
+            write_json(ofs);
+            return bool(ofs);
+        }
+};
+
+class PerfScope {
+    // Adds the calling thread's counts over the enclosing scope to `total`; a null total
+    // measures nothing and leaves the counters unopened.
+    public:
+        PerfScope(PerfCounterValues* total) : total(total) {
+            if (total)
+                start = thread_perf_counters().read();
+        }
+
+        ~PerfScope() {
+            if (total)
+                total->add_difference(thread_perf_counters().read(), start);
+        }
+
+        PerfScope(const PerfScope&) = delete;
+        PerfScope& operator=(const PerfScope&) = delete;
+
+    private:
+        PerfCounterValues* total;
+        PerfCounterValues start;
+};
+
+#endif
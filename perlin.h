@@ -3,6 +3,16 @@
 
 #include "common.h"
 
+#include "aabb.h"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PERLIN_SSE 1
+#endif
+
 class Perlin
 {
 public:
@@ -11,6 +21,9 @@ public:
         for (int i = 0; i < pointCount; i++)
         {
             randVec[i] = unit_vector(Vector3::random(-1,1));
+            randX[i] = randVec[i].x();
+            randY[i] = randVec[i].y();
+            randZ[i] = randVec[i].z();
         }
 
         perlin_generate_perm(permX);
@@ -19,6 +32,15 @@ public:
     }
 
     float noise(const Point3 &p) const
+    {
+#ifdef PERLIN_SSE
+        return noise_sse(p);
+#else
+        return noise_scalar(p);
+#endif
+    }
+
+    float noise_scalar(const Point3 &p) const
     {
         float u = p.x() - std::floor(p.x());
         float v = p.y() - std::floor(p.y());
@@ -37,23 +59,97 @@ public:
                         permY[(j+dj) & 255] ^
                         permZ[(k+dk) & 255]
                     ];
-                }  
+                }
             }
         }
-            
+
 
         return perlin_interp(c, u, v, w);
     }
 
+    void noise4(const float x[4], const float y[4], const float z[4], float out[4]) const
+    {
+        // Evaluates noise at four points at once, one point per SIMD lane. Every lane performs
+        // the same operations in the same order as noise_scalar(), so results match it exactly.
+#ifdef PERLIN_SSE
+        __m128 px = _mm_loadu_ps(x);
+        __m128 py = _mm_loadu_ps(y);
+        __m128 pz = _mm_loadu_ps(z);
+
+        __m128i i = floor_epi32(px);
+        __m128i j = floor_epi32(py);
+        __m128i k = floor_epi32(pz);
+
+        __m128 u = _mm_sub_ps(px, _mm_cvtepi32_ps(i));
+        __m128 v = _mm_sub_ps(py, _mm_cvtepi32_ps(j));
+        __m128 w = _mm_sub_ps(pz, _mm_cvtepi32_ps(k));
+
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 three = _mm_set1_ps(3.0f);
+        const __m128 two = _mm_set1_ps(2.0f);
+        __m128 uu = _mm_mul_ps(_mm_mul_ps(u, u), _mm_sub_ps(three, _mm_mul_ps(two, u)));
+        __m128 vv = _mm_mul_ps(_mm_mul_ps(v, v), _mm_sub_ps(three, _mm_mul_ps(two, v)));
+        __m128 ww = _mm_mul_ps(_mm_mul_ps(w, w), _mm_sub_ps(three, _mm_mul_ps(two, w)));
+        __m128 weightU[2] = { _mm_sub_ps(one, uu), uu };
+        __m128 weightV[2] = { _mm_sub_ps(one, vv), vv };
+        __m128 weightW[2] = { _mm_sub_ps(one, ww), ww };
+        __m128 offsetU[2] = { u, _mm_sub_ps(u, one) };
+        __m128 offsetV[2] = { v, _mm_sub_ps(v, one) };
+        __m128 offsetW[2] = { w, _mm_sub_ps(w, one) };
+
+        alignas(16) int ii[4], jj[4], kk[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(ii), i);
+        _mm_store_si128(reinterpret_cast<__m128i*>(jj), j);
+        _mm_store_si128(reinterpret_cast<__m128i*>(kk), k);
+
+        __m128 accum = _mm_setzero_ps();
+        for (int di=0; di < 2; di++)
+            for (int dj=0; dj < 2; dj++)
+                for (int dk=0; dk < 2; dk++) {
+                    alignas(16) float gx[4], gy[4], gz[4];
+                    for (int lane = 0; lane < 4; lane++) {
+                        int h = permX[(ii[lane]+di) & 255] ^ permY[(jj[lane]+dj) & 255] ^ permZ[(kk[lane]+dk) & 255];
+                        gx[lane] = randX[h];
+                        gy[lane] = randY[h];
+                        gz[lane] = randZ[h];
+                    }
+
+                    __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(gx), offsetU[di]),
+                                                     _mm_mul_ps(_mm_load_ps(gy), offsetV[dj])),
+                                          _mm_mul_ps(_mm_load_ps(gz), offsetW[dk]));
+                    __m128 weight = _mm_mul_ps(_mm_mul_ps(weightU[di], weightV[dj]), weightW[dk]);
+                    accum = _mm_add_ps(accum, _mm_mul_ps(weight, d));
+                }
+
+        _mm_storeu_ps(out, accum);
+#else
+        for (int lane = 0; lane < 4; lane++)
+            out[lane] = noise_scalar(Point3(x[lane], y[lane], z[lane]));
+#endif
+    }
+
         double turb(const Point3& p, int depth) const {
+        // Octaves are evaluated four at a time through noise4(), then summed in octave order.
         float accum = 0.0;
         Point3 temp = p;
         float weight = 1.0;
 
-        for (int i = 0; i < depth; i++) {
-            accum += weight * noise(temp);
-            weight *= 0.5;
-            temp *= 2;
+        for (int i = 0; i < depth; i += 4) {
+            int count = std::min(4, depth - i);
+            float x[4], y[4], z[4], octave[4];
+            for (int o = 0; o < 4; o++) {
+                x[o] = temp.x();
+                y[o] = temp.y();
+                z[o] = temp.z();
+                if (o < count)
+                    temp *= 2;
+            }
+
+            noise4(x, y, z, octave);
+            for (int o = 0; o < count; o++) {
+                accum += weight * octave[o];
+                weight *= 0.5;
+            }
         }
 
         return std::fabs(accum);
@@ -62,6 +158,10 @@ public:
 private:
     static const int pointCount = 256;
     Vector3 randVec[pointCount];
+    // Structure-of-arrays copy of randVec for the SIMD paths.
+    alignas(16) float randX[pointCount];
+    alignas(16) float randY[pointCount];
+    alignas(16) float randZ[pointCount];
     int permX[pointCount];
     int permY[pointCount];
     int permZ[pointCount];
@@ -103,6 +203,134 @@ private:
 
         return accum;
     }
+
+#ifdef PERLIN_SSE
+    static __m128i floor_epi32(__m128 x) {
+        // SSE2 has no floor instruction: truncate, then step down the lanes that rounded up.
+        __m128i t = _mm_cvttps_epi32(x);
+        __m128 roundedUp = _mm_cmpgt_ps(_mm_cvtepi32_ps(t), x);
+        return _mm_add_epi32(t, _mm_castps_si128(roundedUp));
+    }
+
+    float noise_sse(const Point3 &p) const
+    {
+        // Evaluates all eight lattice corners in two four-wide halves (di = 0 and di = 1). The
+        // per-corner products are summed in the same order as perlin_interp() so the result is
+        // identical to noise_scalar().
+        float fx = std::floor(p.x());
+        float fy = std::floor(p.y());
+        float fz = std::floor(p.z());
+        float u = p.x() - fx;
+        float v = p.y() - fy;
+        float w = p.z() - fz;
+
+        int i = int(fx);
+        int j = int(fy);
+        int k = int(fz);
+
+        int y0 = permY[j & 255], y1 = permY[(j+1) & 255];
+        int z0 = permZ[k & 255], z1 = permZ[(k+1) & 255];
+
+        float uu = u*u*(3-2*u);
+        float vv = v*v*(3-2*v);
+        float ww = w*w*(3-2*w);
+
+        // Lanes are ordered (dj, dk) = 00, 01, 10, 11 to match the scalar loop.
+        __m128 weightV = _mm_setr_ps(1-vv, 1-vv, vv, vv);
+        __m128 weightW = _mm_setr_ps(1-ww, ww, 1-ww, ww);
+        __m128 offsetV = _mm_setr_ps(v, v, v-1, v-1);
+        __m128 offsetW = _mm_setr_ps(w, w-1, w, w-1);
+
+        alignas(16) float product[8];
+        for (int di = 0; di < 2; di++) {
+            int x = permX[(i+di) & 255];
+            int h0 = x ^ y0 ^ z0, h1 = x ^ y0 ^ z1, h2 = x ^ y1 ^ z0, h3 = x ^ y1 ^ z1;
+
+            __m128 gx = _mm_setr_ps(randX[h0], randX[h1], randX[h2], randX[h3]);
+            __m128 gy = _mm_setr_ps(randY[h0], randY[h1], randY[h2], randY[h3]);
+            __m128 gz = _mm_setr_ps(randZ[h0], randZ[h1], randZ[h2], randZ[h3]);
+
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, _mm_set1_ps(di ? u-1 : u)),
+                                             _mm_mul_ps(gy, offsetV)),
+                                  _mm_mul_ps(gz, offsetW));
+            // (wu * wv) * ww, matching the association of the scalar product.
+            __m128 weightU = _mm_set1_ps(di ? uu : 1-uu);
+            __m128 weight = _mm_mul_ps(_mm_mul_ps(weightU, weightV), weightW);
+            _mm_store_ps(product + 4*di, _mm_mul_ps(weight, d));
+        }
+
+        float accum = 0.0;
+        for (int n = 0; n < 8; n++)
+            accum += product[n];
+        return accum;
+    }
+#endif
+};
+
+class NoiseVolume
+{
+    // A baked grid of Perlin noise samples over a bounded domain. Lookups are a trilinear
+    // interpolation of the eight surrounding samples, so they approximate (rather than
+    // reproduce) the analytic noise, with error shrinking as the resolution grows.
+public:
+    NoiseVolume(const Perlin& perlin, const AABB& domain, int resolution)
+      : domain(domain), res(std::max(2, resolution))
+    {
+        samples.resize(size_t(res) * res * res);
+        for (int c = 0; c < 3; c++) {
+            const Interval& axis = domain.axis_interval(c);
+            step[c] = axis.size() / (res - 1);
+            invStep[c] = 1.0f / step[c];
+        }
+
+        for (int k = 0; k < res; k++)
+            for (int j = 0; j < res; j++)
+                for (int i = 0; i < res; i++) {
+                    Point3 p(domain.x.min + i*step[0], domain.y.min + j*step[1], domain.z.min + k*step[2]);
+                    samples[index(i, j, k)] = perlin.noise(p);
+                }
+    }
+
+    bool contains(const Point3& p) const {
+        return domain.x.contains(p.x()) && domain.y.contains(p.y()) && domain.z.contains(p.z());
+    }
+
+    float noise(const Point3& p) const {
+        float fx = (p.x() - domain.x.min) * invStep[0];
+        float fy = (p.y() - domain.y.min) * invStep[1];
+        float fz = (p.z() - domain.z.min) * invStep[2];
+
+        int i = std::min(int(fx), res - 2);
+        int j = std::min(int(fy), res - 2);
+        int k = std::min(int(fz), res - 2);
+        float u = fx - i;
+        float v = fy - j;
+        float w = fz - k;
+
+        float c00 = lerp(samples[index(i, j,   k  )], samples[index(i+1, j,   k  )], u);
+        float c10 = lerp(samples[index(i, j+1, k  )], samples[index(i+1, j+1, k  )], u);
+        float c01 = lerp(samples[index(i, j,   k+1)], samples[index(i+1, j,   k+1)], u);
+        float c11 = lerp(samples[index(i, j+1, k+1)], samples[index(i+1, j+1, k+1)], u);
+
+        return lerp(lerp(c00, c10, v), lerp(c01, c11, v), w);
+    }
+
+    size_t memory_bytes() const { return samples.size() * sizeof(float); }
+
+private:
+    AABB domain;
+    int res;
+    float step[3];
+    float invStep[3];
+    std::vector<float> samples;
+
+    size_t index(int i, int j, int k) const {
+        return (size_t(k) * res + j) * res + i;
+    }
+
+    static float lerp(float a, float b, float t) {
+        return a + t * (b - a);
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -4,7 +4,9 @@
 #include "common.h"
 
 #include "hittable.h"
-#include "hittablelist.h"
+#include "hittableList.h"
+
+#include <utility>
 
 class Quad : public Hittable {
     public:
@@ -26,6 +28,7 @@ class Quad : public Hittable {
         AABB bounding_box() const override { return bbox; }
 
         bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override {
+            STAT_INC(statCounter);
             float denom = dot(normal, r.direction());
 
             if (std::fabs(denom) < 1e-8){
@@ -49,10 +52,34 @@ class Quad : public Hittable {
             rec.t = t;
             rec.p = intersection;
             rec.mat = mat;
+            rec.objectId = objectId;
             rec.set_face_normal(r, normal);
 
             return true;
         }
+
+        bool occluded(const Ray& r, Interval rayT) const override {
+            STAT_INC(statCounter);
+            float denom = dot(normal, r.direction());
+            if (std::fabs(denom) < 1e-8)
+                return false;
+
+            float t = (D - dot(normal, r.origin())) / denom;
+            if (!rayT.contains(t))
+                return false;
+
+            Vector3 planar_hitpt_vector = r.at(t) - Q;
+            HitRecord uv;   // Receives the UVs is_interior() sets, unused here
+            return is_interior(dot(w, cross(planar_hitpt_vector, v)), dot(w, cross(u, planar_hitpt_vector)), uv);
+        }
+
+        bool bake(const Transform& xf, HittableList& out) const override {
+            shared_ptr<Hittable> baked = with_frame(xf.point(Q), xf.vector(u), xf.vector(v));
+            baked->objectId = objectId;
+            out.add(baked);
+            return true;
+        }
+
     virtual bool is_interior(float a, float b, HitRecord& rec) const {
         Interval unitInterval = Interval(0, 1);
         // Given the hit point in plane coordinates, return false if it is outside the
@@ -66,6 +93,11 @@ class Quad : public Hittable {
         return true;
     }
 
+    // The same kind of primitive over another corner and edges, for bake().
+    virtual shared_ptr<Hittable> with_frame(const Point3& Q, const Vector3& u, const Vector3& v) const {
+        return make_shared<Quad>(Q, u, v, mat);
+    }
+
     protected:
         Point3 Q;
         Vector3 u, v, w;
@@ -73,13 +105,157 @@ class Quad : public Hittable {
         AABB bbox;
         Vector3 normal;
         float D;
+        STATCOUNTER statCounter = STAT_TEST_QUAD;   // Primitive test counted by hit() and occluded()
 };
 
 
-inline shared_ptr<HittableList> Box(const Point3& a, const Point3& b, shared_ptr<Material> mat)
+class BoxPrimitive : public Hittable {
+    // An axis-aligned box intersected with one slab test. Normals and UVs match the six quads
+    // Box() used to build, so textures map onto the faces as before; rotated boxes go through
+    // the Rotate wrappers like any other object, until bake() folds the rotation into the box.
+    public:
+        BoxPrimitive(const Point3& a, const Point3& b, shared_ptr<Material> mat)
+          : lo(std::fmin(a.x(), b.x()), std::fmin(a.y(), b.y()), std::fmin(a.z(), b.z())),
+            hi(std::fmax(a.x(), b.x()), std::fmax(a.y(), b.y()), std::fmax(a.z(), b.z())),
+            mat(mat), bbox(lo, hi) {}
+
+        // The box [lo, hi] placed in the world by the rigid transform frame.
+        BoxPrimitive(const Point3& lo, const Point3& hi, shared_ptr<Material> mat, const Transform& frame)
+          : lo(lo), hi(hi), mat(mat), frame(frame), oriented(!frame.is_translation()) {
+            if (!oriented) {
+                this->lo = lo + frame.offset;
+                this->hi = hi + frame.offset;
+                this->frame = Transform();
+                bbox = AABB(this->lo, this->hi);
+                return;
+            }
+            bbox = AABB::empty;
+            for (int corner = 0; corner < 8; corner++) {
+                Point3 p((corner & 1) ? hi.x() : lo.x(), (corner & 2) ? hi.y() : lo.y(), (corner & 4) ? hi.z() : lo.z());
+                Point3 world = frame.point(p);
+                bbox = AABB(bbox, AABB(world, world));
+            }
+        }
+
+        AABB bounding_box() const override { return bbox; }
+
+        bool hit(const Ray& world, Interval rayT, HitRecord& rec) const override {
+            STAT_INC(STAT_TEST_BOX);
+            Ray r = oriented ? to_box_space(world) : world;
+            float tNear, tFar;
+            int nearAxis, farAxis;
+            if (!slabs(r, tNear, nearAxis, tFar, farAxis))
+                return false;
+
+            // The entry point, or the exit point for rays that start inside (or whose entry
+            // lies before rayT), as the nearest of the six quads would be.
+            float t = tNear;
+            int axis = nearAxis;
+            bool exiting = false;
+            if (!rayT.contains(t)) {
+                t = tFar;
+                axis = farAxis;
+                exiting = true;
+                if (!rayT.contains(t))
+                    return false;
+            }
+
+            // The face is on the max side along the axis when the ray enters through it
+            // moving in the negative direction, or leaves through it moving in the positive.
+            bool maxSide = (r.direction()[axis] < 0) != exiting;
+            Vector3 outwardNormal(0, 0, 0);
+            outwardNormal[axis] = maxSide ? 1.0f : -1.0f;
+
+            rec.t = t;
+            face_uv(r.at(t), axis, maxSide, rec.u, rec.v);
+            rec.p = world.at(t);
+            rec.mat = mat;
+            rec.objectId = objectId;
+            rec.set_face_normal(world, oriented ? frame.vector(outwardNormal) : outwardNormal);
+            return true;
+        }
+
+        bool occluded(const Ray& world, Interval rayT) const override {
+            STAT_INC(STAT_TEST_BOX);
+            float tNear, tFar;
+            int nearAxis, farAxis;
+            if (!slabs(oriented ? to_box_space(world) : world, tNear, nearAxis, tFar, farAxis))
+                return false;
+            return rayT.contains(tNear) || rayT.contains(tFar);
+        }
+
+        bool bake(const Transform& xf, HittableList& out) const override {
+            // A rotated box keeps one slab test, in its own frame; a translated one stays
+            // axis-aligned.
+            shared_ptr<Hittable> baked = make_shared<BoxPrimitive>(lo, hi, mat, xf * frame);
+            baked->objectId = objectId;
+            out.add(baked);
+            return true;
+        }
+
+    private:
+        Point3 lo, hi;              // In the box's frame when oriented
+        shared_ptr<Material> mat;
+        AABB bbox;
+        Transform frame;            // Box to world, used only if oriented
+        bool oriented = false;
+
+        Ray to_box_space(const Ray& r) const {
+            return Ray(frame.inverse_vector(r.origin() - frame.offset), frame.inverse_vector(r.direction()), r.time());
+        }
+
+        bool slabs(const Ray& r, float& tNear, int& nearAxis, float& tFar, int& farAxis) const {
+            // Entry and exit distances of the whole line, and the axes whose slabs set them.
+            tNear = -infinity;
+            tFar = infinity;
+            nearAxis = farAxis = 0;
+            for (int axis = 0; axis < 3; axis++) {
+                float invD = 1.0f / r.direction()[axis];
+                float t0 = (lo[axis] - r.origin()[axis]) * invD;
+                float t1 = (hi[axis] - r.origin()[axis]) * invD;
+                if (t0 > t1)
+                    std::swap(t0, t1);
+                if (t0 > tNear) {
+                    tNear = t0;
+                    nearAxis = axis;
+                }
+                if (t1 < tFar) {
+                    tFar = t1;
+                    farAxis = axis;
+                }
+            }
+            return tNear <= tFar;
+        }
+
+        void face_uv(const Point3& p, int axis, bool maxSide, float& u, float& v) const {
+            // Box() built the faces as Quad(Q, u, v) with these origins and edge directions.
+            Vector3 f(0, 0, 0);
+            for (int c = 0; c < 3; c++)
+                f[c] = hi[c] > lo[c] ? (p[c] - lo[c]) / (hi[c] - lo[c]) : 0;
+            if (axis == 0) {            // right: u = -dz, left: u = dz; v = dy
+                u = maxSide ? 1 - f.z() : f.z();
+                v = f.y();
+            }
+            else if (axis == 1) {       // top: v = -dz, bottom: v = dz; u = dx
+                u = f.x();
+                v = maxSide ? 1 - f.z() : f.z();
+            }
+            else {                      // front: u = dx, back: u = -dx; v = dy
+                u = maxSide ? f.x() : 1 - f.x();
+                v = f.y();
+            }
+        }
+};
+
+inline shared_ptr<BoxPrimitive> Box(const Point3& a, const Point3& b, shared_ptr<Material> mat)
 {
     // Returns the 3D box (six sides) that contains the two opposite vertices a & b.
+    return make_shared<BoxPrimitive>(a, b, mat);
+}
 
+inline shared_ptr<HittableList> BoxQuads(const Point3& a, const Point3& b, shared_ptr<Material> mat)
+{
+    // The same box as six quads, as Box() built it before BoxPrimitive; kept for comparison.
     auto sides = make_shared<HittableList>();
 
     // Construct the two opposite vertices with the minimum and maximum coordinates.
@@ -102,7 +278,7 @@ inline shared_ptr<HittableList> Box(const Point3& a, const Point3& b, shared_ptr
 
 class Triangle : public Quad {
     public:
-    Triangle(const Point3& a, const Vector3& ab, const Vector3& ac, shared_ptr<Material> mat) : Quad(a, ab, ac, mat) {}
+    Triangle(const Point3& a, const Vector3& ab, const Vector3& ac, shared_ptr<Material> mat) : Quad(a, ab, ac, mat) { statCounter = STAT_TEST_TRIANGLE; }
 
     virtual bool is_interior(float a, float b, HitRecord& rec) const override {
         if((a < 0) || (b < 0) || (a+b > 1)){
@@ -113,11 +289,15 @@ class Triangle : public Quad {
         rec.v = b;
         return true;
     }
+
+    virtual shared_ptr<Hittable> with_frame(const Point3& Q, const Vector3& u, const Vector3& v) const override {
+        return make_shared<Triangle>(Q, u, v, mat);
+    }
 };
 
 class Ellipse : public Quad {
   public:
-    Ellipse(const Point3& center, const Vector3& sideA, const Vector3& sideB, shared_ptr<Material> mat) : Quad(center, sideA, sideB, mat){}
+    Ellipse(const Point3& center, const Vector3& sideA, const Vector3& sideB, shared_ptr<Material> mat) : Quad(center, sideA, sideB, mat) { statCounter = STAT_TEST_ELLIPSE; }
 
     virtual void set_bounding_box() override {
         bbox = AABB(Q - u - v, Q + u + v);
@@ -131,5 +311,9 @@ class Ellipse : public Quad {
         rec.v = b/2 + 0.5;
         return true;
     }
+
+    virtual shared_ptr<Hittable> with_frame(const Point3& Q, const Vector3& u, const Vector3& v) const override {
+        return make_shared<Ellipse>(Q, u, v, mat);
+    }
 };
 #endif
\ No newline at end of file
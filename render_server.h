@@ -0,0 +1,508 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include "common.h"
+
+#include "bvh_cache.h"
+#include "camera.h"
+#include "distributed.h"
+#include "image_io.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+// A long-running render process taking jobs over a Unix domain socket. Each connection sends
+// one request line:
+//
+//   render <scene file> [priority <n>] [samples <n>]
+//   shutdown                                   (finishes the queued jobs, then exits)
+//
+// and receives, for a render:
+//
+//   queued <job> <jobs ahead>
+//   started <job> <width> <height> <samples> <output file>
+//   image <job> <samples so far> <bytes>       followed by that many bytes of PPM
+//   ...
+//   done <job> <seconds>                       or: error <message>
+//
+// Jobs run one at a time on the server's render threads, highest priority first and in
+// arrival order within a priority. Images refine progressively, in passes that double the
+// samples so far up to maxPassSeconds of rendering; between passes a job gives way to a waiting
+// job of higher priority and resumes where it left off, so a new job waits at most about one
+// such pass. The most recently used scenes (with their decoded textures) and their BVHs stay in
+// memory (up to maxCachedScenes) for later jobs until the scene file changes. The server writes
+// nothing next to clients' scenes: an existing binary cache of a scene is used, but none is
+// written.
+
+class RenderJob {
+    public:
+        uint64_t id;
+        int priority = 0;
+        int samples = 0;                // 0: the scene's own
+        std::string scenePath;
+        int fd = -1;                    // The client's connection
+
+        // Progress, kept while a higher-priority job runs
+        bool started = false;
+        Camera camera;
+        shared_ptr<Hittable> world;
+        std::string output;
+        std::vector<Color> accum;
+        int samplesDone = 0;
+        double seconds = 0;
+};
+
+class CachedScene {
+    public:
+        std::filesystem::file_time_type modified;
+        Scene scene;
+        shared_ptr<Hittable> accel;
+        uint64_t lastUsed = 0;          // RenderServer::loads when a job last used the scene
+};
+
+#ifdef __linux__
+
+inline bool receive_line(int fd, std::string& line)
+{
+    line.clear();
+    char c;
+    while (receive_all(fd, &c, 1))
+    {
+        if (c == '\n')
+            return true;
+        line += c;
+        if (line.size() > 4096)
+            return false;
+    }
+    return false;
+}
+
+inline bool send_line(int fd, const std::string& line)
+{
+    return send_all(fd, line.data(), line.size()) && send_all(fd, "\n", 1);
+}
+
+inline int open_unix_socket(const std::string& path, bool listening)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "ERROR: Socket path '" << path << "' is too long.\n";
+        return -1;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        std::cerr << "ERROR: Could not create a socket: " << std::strerror(errno) << ".\n";
+        return -1;
+    }
+    if (listening)
+        unlink(path.c_str());
+    int result = listening ? bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address))
+                           : connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    if (result != 0 || (listening && listen(fd, 16) != 0))
+    {
+        std::cerr << "ERROR: Could not " << (listening ? "listen on" : "connect to") << " '" << path << "': " << std::strerror(errno) << ".\n";
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+class RenderServer {
+    public:
+        // Longest pass to plan, at the job's measured time per sample (one sample can take longer).
+        double maxPassSeconds = 1.0;
+        // Loaded scenes to keep for later jobs; the least recently used one goes first. Started
+        // jobs hold on to their BVH, so eviction never disturbs a render.
+        size_t maxCachedScenes = 4;
+
+        RenderServer(const std::string& socketPath, unsigned threads) : socketPath(socketPath), threads(threads) {}
+
+        bool run()
+        {
+            // Serves until a client asks for a shutdown and the queue has drained.
+            listener = open_unix_socket(socketPath, true);
+            if (listener < 0)
+                return false;
+            std::clog << "Serving render jobs on " << socketPath << std::endl;
+            std::thread acceptor(&RenderServer::accept_jobs, this);
+
+            while (shared_ptr<RenderJob> job = next_job())
+                run_job(job);
+
+            acceptor.join();
+            close(listener);
+            unlink(socketPath.c_str());
+            return true;
+        }
+
+    private:
+        std::string socketPath;
+        unsigned threads;
+        int listener = -1;
+
+        std::mutex mutex;               // Guards everything below but the scene cache
+        std::condition_variable queued;
+        std::condition_variable readersDone;
+        std::vector<shared_ptr<RenderJob>> queue;
+        bool stopping = false;          // A shutdown was requested
+        bool accepting = true;          // Requests may still be queued
+        int readers = 0;                // Connections whose request is being read
+        uint64_t nextId = 1;
+
+        std::map<std::string, CachedScene> scenes;  // Used by the render loop only
+        uint64_t loads = 0;
+
+        static bool runs_before(const RenderJob& a, const RenderJob& b)
+        {
+            return a.priority != b.priority ? a.priority > b.priority : a.id < b.id;
+        }
+
+        void accept_jobs()
+        {
+            // Hands each connection to a thread of its own to read and queue its request, so a
+            // slow client holds up no one else; the render loop does the rest. Once a shutdown
+            // request has closed the listener, waits for the requests still being read.
+            while (true)
+            {
+                int fd = accept(listener, nullptr, nullptr);
+                if (fd < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!stopping)
+                        std::cerr << "ERROR: accept failed: " << std::strerror(errno) << ".\n";
+                    break;
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                readers++;
+                std::thread(&RenderServer::read_request, this, fd).detach();
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            readersDone.wait(lock, [this] { return readers == 0; });
+            accepting = false;
+            queued.notify_one();
+        }
+
+        void read_request(int fd)
+        {
+            handle_request(fd);
+            std::lock_guard<std::mutex> lock(mutex);
+            readers--;
+            readersDone.notify_one();
+        }
+
+        void handle_request(int fd)
+        {
+            timeval timeout = { 10, 0 };    // A stalled client must not keep its thread forever
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            std::string line;
+            if (!receive_line(fd, line))
+            {
+                close(fd);
+                return;
+            }
+            std::istringstream request(line);
+            std::string command;
+            request >> command;
+            if (command == "shutdown")
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                shutdown(listener, SHUT_RDWR);  // Wakes the acceptor from accept()
+                send_line(fd, "ok");
+                close(fd);
+                return;
+            }
+
+            shared_ptr<RenderJob> job = make_shared<RenderJob>();
+            job->fd = fd;
+            std::string option;
+            bool valid = command == "render" && bool(request >> job->scenePath);
+            while (valid && request >> option)
+            {
+                if (option == "priority")
+                    valid = bool(request >> job->priority);
+                else if (option == "samples")
+                    valid = bool(request >> job->samples) && job->samples > 0 && job->samples <= 65535;
+                else
+                    valid = false;
+            }
+            if (!valid)
+            {
+                send_line(fd, "error bad request '" + line + "'");
+                close(fd);
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            job->id = nextId++;
+            size_t ahead = std::count_if(queue.begin(), queue.end(), [&](const shared_ptr<RenderJob>& other) { return runs_before(*other, *job); });
+            send_line(fd, "queued " + std::to_string(job->id) + " " + std::to_string(ahead));
+            queue.push_back(job);
+            queued.notify_one();
+        }
+
+        shared_ptr<RenderJob> next_job()
+        {
+            // The queued job to run next, or nullptr once nothing is queued or can be any more.
+            std::unique_lock<std::mutex> lock(mutex);
+            queued.wait(lock, [this] { return !queue.empty() || !accepting; });
+            if (queue.empty())
+                return nullptr;
+            auto next = std::min_element(queue.begin(), queue.end(), [](const shared_ptr<RenderJob>& a, const shared_ptr<RenderJob>& b) { return runs_before(*a, *b); });
+            shared_ptr<RenderJob> job = *next;
+            queue.erase(next);
+            return job;
+        }
+
+        bool outranked(const RenderJob& job)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const shared_ptr<RenderJob>& other : queue)
+                if (other->priority > job.priority)
+                    return true;
+            return false;
+        }
+
+        void requeue(const shared_ptr<RenderJob>& job)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(job);
+        }
+
+        void finish(RenderJob& job, const std::string& message)
+        {
+            send_line(job.fd, message);
+            close(job.fd);
+            job.fd = -1;
+        }
+
+        const CachedScene* load(const std::string& path)
+        {
+            // The scene from the cache while its file is unchanged, loaded otherwise.
+            std::error_code ec;
+            std::filesystem::file_time_type modified = std::filesystem::last_write_time(path, ec);
+            if (ec)
+            {
+                std::cerr << "ERROR: Could not open scene file '" << path << "'.\n";
+                return nullptr;
+            }
+            loads++;
+            auto cached = scenes.find(path);
+            if (cached != scenes.end() && cached->second.modified == modified)
+            {
+                cached->second.lastUsed = loads;
+                return &cached->second;
+            }
+
+            CachedScene entry;
+            entry.modified = modified;
+            entry.lastUsed = loads;
+            if (!load_scene(path, entry.scene, false))
+                return nullptr;
+            const Camera& camera = entry.scene.camera;
+            entry.accel = build_bvh(entry.scene.world, camera.bvhCacheDir, camera.bakeTransforms, camera.timeSplitBVH);
+            std::clog << "Loaded " << path << std::endl;
+            if (cached != scenes.end())
+                scenes.erase(cached);
+            while (!scenes.empty() && scenes.size() >= std::max<size_t>(1, maxCachedScenes))
+            {
+                auto oldest = std::min_element(scenes.begin(), scenes.end(), [](const auto& a, const auto& b)
+                {
+                    return a.second.lastUsed < b.second.lastUsed;
+                });
+                std::clog << "Evicted " << oldest->first << std::endl;
+                scenes.erase(oldest);
+            }
+            return &(scenes[path] = std::move(entry));
+        }
+
+        void run_job(const shared_ptr<RenderJob>& job)
+        {
+            TRACE_SCOPE("render job", "server", "job", int64_t(job->id));
+            if (!job->started)
+            {
+                const CachedScene* cached = load(job->scenePath);
+                if (!cached)
+                {
+                    finish(*job, "error could not load scene '" + job->scenePath + "'");
+                    return;
+                }
+                job->camera = cached->scene.camera;
+                job->camera.threadCount = uint16_t(threads);
+                if (job->samples > 0)
+                    job->camera.samplesPerPixel = uint16_t(job->samples);
+                job->world = cached->accel;
+                job->output = cached->scene.output;
+                job->started = true;
+                std::ostringstream started;
+                started << "started " << job->id << ' ' << job->camera.imageWidth << ' ' << job->camera.image_height()
+                        << ' ' << job->camera.samplesPerPixel << ' ' << job->output;
+                if (!send_line(job->fd, started.str()))
+                {
+                    finish(*job, "");
+                    return;
+                }
+            }
+            std::clog << "Job " << job->id << " (priority " << job->priority << "): " << job->scenePath
+                      << (job->samplesDone > 0 ? ", resumed" : "") << std::endl;
+
+            Camera& camera = job->camera;
+            while (job->samplesDone < camera.samplesPerPixel)
+            {
+                if (job->samplesDone > 0 && outranked(*job))
+                {
+                    std::clog << "Job " << job->id << " gives way at " << job->samplesDone << " samples" << std::endl;
+                    requeue(job);
+                    return;
+                }
+
+                auto start = std::chrono::steady_clock::now();
+                int samples = std::min(std::max(job->samplesDone, 1), camera.samplesPerPixel - job->samplesDone);
+                if (job->seconds > 0)
+                    samples = std::max(1, int(std::min<double>(samples, maxPassSeconds * job->samplesDone / job->seconds)));
+                camera.render_pass(*job->world, job->accum, uint16_t(samples));
+                job->samplesDone += samples;
+                job->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                std::ostringstream image;
+                write_ppm(image, job->accum, camera.imageWidth, camera.image_height(), 1.0f / job->samplesDone);
+                std::string bytes = image.str();
+                std::ostringstream header;
+                header << "image " << job->id << ' ' << job->samplesDone << ' ' << bytes.size();
+                if (!send_line(job->fd, header.str()) || !send_all(job->fd, bytes.data(), bytes.size()))
+                {
+                    std::clog << "Job " << job->id << ": the client went away" << std::endl;
+                    finish(*job, "");
+                    return;
+                }
+            }
+            finish(*job, "done " + std::to_string(job->id) + " " + std::to_string(job->seconds));
+        }
+};
+
+inline bool submit_render_job(const std::string& socketPath, const std::string& scenePath, int priority, int samples)
+{
+    // Queues a render of scenePath (which the server opens itself) and writes each progressive
+    // image to the scene's output file here as it arrives. Returns true once the job is done.
+    int fd = open_unix_socket(socketPath, false);
+    if (fd < 0)
+        return false;
+    std::error_code ec;
+    std::string path = std::filesystem::absolute(scenePath, ec).string();
+    std::ostringstream request;
+    request << "render " << path << " priority " << priority;
+    if (samples > 0)
+        request << " samples " << samples;
+
+    std::string line, output;
+    bool done = false;
+    bool failed = false;
+    if (send_line(fd, request.str()))
+    {
+        while (!done && !failed && receive_line(fd, line))
+        {
+            std::istringstream reply(line);
+            std::string kind;
+            uint64_t job;
+            reply >> kind >> job;
+            if (kind == "image")
+            {
+                int samplesSoFar;
+                size_t size;
+                reply >> samplesSoFar >> size;
+                std::string bytes(size, '\0');
+                if (!receive_all(fd, &bytes[0], size))
+                    break;
+                // Replaced whole, so a viewer never sees a partly written image.
+                std::ofstream(output + ".part", std::ios::binary) << bytes;
+                std::filesystem::rename(output + ".part", output, ec);
+                std::clog << "\r" << output << ": " << samplesSoFar << " samples " << std::flush;
+                continue;
+            }
+            if (kind == "started")
+            {
+                int width, height, spp;
+                reply >> width >> height >> spp >> std::ws;
+                std::getline(reply, output);
+            }
+            done = kind == "done";
+            failed = kind == "error";
+            if (failed)
+                std::cerr << "ERROR: " << line.substr(6) << "\n";
+            else
+                std::clog << (done ? "\n" : "") << line << std::endl;
+        }
+    }
+    close(fd);
+    if (!done && !failed)
+        std::cerr << "ERROR: The render server closed the connection.\n";
+    return done;
+}
+
+inline bool stop_render_server(const std::string& socketPath)
+{
+    int fd = open_unix_socket(socketPath, false);
+    if (fd < 0)
+        return false;
+    std::string reply;
+    bool stopped = send_line(fd, "shutdown") && receive_line(fd, reply) && reply == "ok";
+    close(fd);
+    return stopped;
+}
+
+#else
+
+class RenderServer {
+    public:
+        RenderServer([[maybe_unused]] const std::string& socketPath, [[maybe_unused]] unsigned threads) {}
+
+        bool run()
+        {
+            std::cerr << "ERROR: The render server is only supported on Linux.\n";
+            return false;
+        }
+};
+
+inline bool submit_render_job([[maybe_unused]] const std::string& socketPath, [[maybe_unused]] const std::string& scenePath,
+                              [[maybe_unused]] int priority, [[maybe_unused]] int samples)
+{
+    std::cerr << "ERROR: The render server is only supported on Linux.\n";
+    return false;
+}
+
+inline bool stop_render_server([[maybe_unused]] const std::string& socketPath)
+{
+    std::cerr << "ERROR: The render server is only supported on Linux.\n";
+    return false;
+}
+
+#endif
+
+#endif
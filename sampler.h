@@ -0,0 +1,472 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "common.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Sample generators for the camera and materials.
+//
+// Every camera sample walks the same fixed dimensions: 0-1 pixel position, 2-3 lens, 4 time,
+// then bounceDimensions per bounce (2D direction and a 1D choice). Fixing the layout keeps each
+// decision on its own well-distributed dimensions no matter which branches earlier bounces
+// took. Samplers other than the independent one are deterministic in (pixel, sample index,
+// dimension), so a pixel's samples can be spread over progressive passes.
+
+enum SAMPLERTYPE {
+    SAMPLER_INDEPENDENT = 0,    // Uniform random, the thread's random_float() stream
+    SAMPLER_STRATIFIED,         // Latin hypercube over the pixel's sample count per dimension
+    SAMPLER_SOBOL,              // Owen-scrambled, index-shuffled Sobol (0,2) pairs
+    SAMPLER_HALTON,             // Owen-scrambled Halton, a prime base per dimension
+    SAMPLER_BLUE_NOISE,         // One scrambled Sobol set, shifted per pixel by blue noise
+    SAMPLER_TYPE_COUNT,
+};
+
+static const char* const samplerTypeNames[SAMPLER_TYPE_COUNT] = {
+    "independent",
+    "stratified",
+    "sobol",
+    "halton",
+    "bluenoise",
+};
+
+inline uint64_t mix_bits(uint64_t v)
+{
+    // splitmix64 finalizer.
+    v ^= v >> 31;
+    v *= 0x7fb5d329728ea185ull;
+    v ^= v >> 27;
+    v *= 0x81dadef4bc2dd44dull;
+    v ^= v >> 33;
+    return v;
+}
+
+inline uint32_t hash32(uint32_t x)
+{
+    // "lowbias32" integer hash; cheap enough to run once per sample dimension.
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline float uint32_to_unit_float(uint32_t x)
+{
+    // [0,1) with the top 24 bits.
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+inline Vector3 sample_unit_vector(float u, float v)
+{
+    // Uniform direction on the unit sphere.
+    float z = 1 - 2 * u;
+    float r = std::sqrt(std::fmax(0.0f, 1 - z * z));
+    float phi = 2 * pi * v;
+    return Vector3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+inline Vector3 sample_unit_disk(float u, float v)
+{
+    // Shirley-Chiu concentric map, which keeps the input's stratification.
+    float a = 2 * u - 1;
+    float b = 2 * v - 1;
+    if (a == 0 && b == 0)
+        return Vector3(0, 0, 0);
+    float r, theta;
+    if (std::fabs(a) > std::fabs(b)) {
+        r = a;
+        theta = (pi / 4) * (b / a);
+    }
+    else {
+        r = b;
+        theta = (pi / 2) - (pi / 4) * (a / b);
+    }
+    return Vector3(r * std::cos(theta), r * std::sin(theta), 0);
+}
+
+inline uint32_t permutation_element(uint32_t i, uint32_t l, uint32_t p)
+{
+    // Element i of a random permutation of [0, l) chosen by p (Kensler, "Correlated
+    // Multi-Jittered Sampling").
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+class Sampler {
+    public:
+        static const int cameraDimensions = 5;
+        static const int bounceDimensions = 3;
+
+        Sampler(uint64_t seed = 0) : seed(seed) {}
+        virtual ~Sampler() = default;
+
+        void start_pixel_sample(int x, int y, uint32_t index) {
+            if (x != px || y != py || !pixelHashValid) {
+                px = x;
+                py = y;
+                uint64_t key = hashPixels ? uint64_t(uint32_t(x)) << 32 | uint32_t(y) : 0;
+                pixelHash = uint32_t(mix_bits(seed ^ mix_bits(key)));
+                pixelHashValid = true;
+            }
+            sampleIndex = index;
+            dimension = 0;
+        }
+
+        void set_dimension(int d) { dimension = d; }
+        void start_bounce(int bounce) { dimension = cameraDimensions + bounce * bounceDimensions; }
+
+        float get_1d() { return sample_1d(dimension++); }
+
+        Vector3 get_2d() {
+            // Returns (u, v, 0).
+            Vector3 uv = sample_2d(dimension);
+            dimension += 2;
+            return uv;
+        }
+
+    protected:
+        uint64_t seed;
+        int px = 0;
+        int py = 0;
+        uint32_t pixelHash = 0;
+        bool pixelHashValid = false;
+        bool hashPixels = true;         // False: every pixel gets the same scrambles
+        uint32_t sampleIndex = 0;
+        int dimension = 0;
+
+        // Scrambling seed for dimension d of the current pixel.
+        uint32_t dimension_hash(int d) const { return hash32(pixelHash + uint32_t(d) * 0x9e3779b9u); }
+
+        virtual float sample_1d(int d) = 0;
+        virtual Vector3 sample_2d(int d) = 0;
+};
+
+class IndependentSampler : public Sampler {
+    protected:
+        float sample_1d(int) override { return random_float(); }
+        Vector3 sample_2d(int) override {
+            float u = random_float();
+            return Vector3(u, random_float(), 0);
+        }
+};
+
+class StratifiedSampler : public Sampler {
+    // Sample i of n falls in stratum perm(i) of each dimension, with a different permutation
+    // per pixel and dimension and a random offset inside the stratum. Samples past n are
+    // independent.
+    public:
+        StratifiedSampler(uint32_t samplesPerPixel, uint64_t seed) : Sampler(seed), count(std::max(1u, samplesPerPixel)) {}
+
+    protected:
+        float sample_1d(int d) override {
+            if (sampleIndex >= count)
+                return random_float();
+            uint32_t h = dimension_hash(d);
+            uint32_t stratum = permutation_element(sampleIndex, count, h);
+            float jitter = uint32_to_unit_float(hash32(h ^ hash32(sampleIndex)));
+            return std::min((stratum + jitter) / count, 0x1.fffffep-1f);
+        }
+
+        Vector3 sample_2d(int d) override {
+            float u = sample_1d(d);
+            return Vector3(u, sample_1d(d + 1), 0);
+        }
+
+    private:
+        uint32_t count;
+};
+
+class SobolSampler : public Sampler {
+    // Burley, "Practical Hash-based Owen Scrambling" (2020): every dimension pair uses the
+    // first two Sobol dimensions, with the sample index shuffled and both coordinates
+    // Owen-scrambled by hashes of (pixel, dimension), so pairs are well stratified and
+    // decorrelated from each other.
+    public:
+        SobolSampler(uint64_t seed) : Sampler(seed) {}
+
+    protected:
+        float sample_1d(int d) override {
+            uint32_t h = dimension_hash(d);
+            uint32_t index = nested_uniform_scramble(sampleIndex, h);
+            return uint32_to_unit_float(nested_uniform_scramble(sobol(index, 0), hash32(h)));
+        }
+
+        Vector3 sample_2d(int d) override {
+            uint32_t h = dimension_hash(d);
+            uint32_t index = nested_uniform_scramble(sampleIndex, h);
+            float u = uint32_to_unit_float(nested_uniform_scramble(sobol(index, 0), hash32(h)));
+            float v = uint32_to_unit_float(nested_uniform_scramble(sobol(index, 1), hash32(h ^ 0x68e31da4u)));
+            return Vector3(u, v, 0);
+        }
+
+    public:
+        static uint32_t sobol(uint32_t index, int dim) {
+            // Dimension 0 is the van der Corput sequence; dimension 1 uses the primitive
+            // polynomial x + 1, whose direction numbers are v[k] = v[k-1] ^ (v[k-1] >> 1).
+            if (dim == 0)
+                return reverse_bits(index);
+            uint32_t result = 0;
+            uint32_t v = 0x80000000u;
+            for (; index; index >>= 1) {
+                if (index & 1)
+                    result ^= v;
+                v ^= v >> 1;
+            }
+            return result;
+        }
+
+        static uint32_t reverse_bits(uint32_t x) {
+            x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+            x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+            x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+            x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+            return (x >> 16) | (x << 16);
+        }
+
+        static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+            // Owen scrambling via the Laine-Karras permutation on the reversed bits.
+            x = reverse_bits(x);
+            x += seed;
+            x ^= x * 0x6c50b47cu;
+            x ^= x * 0xb82f1e52u;
+            x ^= x * 0xc7afe638u;
+            x ^= x * 0x8d22f6e6u;
+            return reverse_bits(x);
+        }
+};
+
+class HaltonSampler : public Sampler {
+    // Radical inverse in the d-th prime base with every digit permuted by a hash of the pixel,
+    // dimension and the digits below it (Owen scrambling). Dimensions past the prime table are
+    // independent.
+    public:
+        HaltonSampler(uint64_t seed) : Sampler(seed) {}
+
+    protected:
+        float sample_1d(int d) override {
+            if (d >= primeCount)
+                return random_float();
+            return scrambled_radical_inverse(primes[d], sampleIndex, dimension_hash(d));
+        }
+
+        Vector3 sample_2d(int d) override {
+            float u = sample_1d(d);
+            return Vector3(u, sample_1d(d + 1), 0);
+        }
+
+    private:
+        static const int primeCount = 64;
+        static constexpr uint32_t primes[primeCount] = {
+            2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+            59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+            137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+            227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311,
+        };
+
+        static float scrambled_radical_inverse(uint32_t base, uint32_t a, uint32_t hash) {
+            // Each digit goes through a random permutation chosen by the digits before it. Once a runs out of digits the scrambled tail is a uniform offset within
+            // the last interval, which is what scrambling the infinite run of zeros gives.
+            double invBaseM = 1;
+            uint32_t reversedDigits = 0;
+            uint32_t node = hash;
+            while (a) {
+                uint32_t next = a / base;
+                uint32_t digit = a - next * base;
+                uint32_t digitHash = hash32(node);
+                node = hash32(node ^ (digit + 1) * 0x9e3779b9u);
+                digit = permutation_element(digit, base, digitHash);
+                reversedDigits = reversedDigits * base + digit;
+                invBaseM /= base;
+                a = next;
+            }
+            double tail = uint32_to_unit_float(hash32(node ^ 0x68e31da4u));
+            return std::min(float(invBaseM * (reversedDigits + tail)), 0x1.fffffep-1f);
+        }
+};
+
+class BlueNoiseTexture {
+    // 64x64 tileable blue-noise ranks from Ulichney's void-and-cluster method, built once.
+    public:
+        static const int size = 64;
+
+        static const BlueNoiseTexture& instance() {
+            static BlueNoiseTexture texture;
+            return texture;
+        }
+
+        float value(int x, int y) const { return values[(y & (size - 1)) * size + (x & (size - 1))]; }
+
+    private:
+        std::vector<float> values;
+
+        BlueNoiseTexture() {
+            const int n = size * size;
+            const float sigma = 1.5f;
+
+            // Toroidal Gaussian energy kernel, indexed by offset.
+            std::vector<float> kernel(n);
+            for (int y = 0; y < size; y++) {
+                for (int x = 0; x < size; x++) {
+                    int dx = std::min(x, size - x);
+                    int dy = std::min(y, size - y);
+                    kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+                }
+            }
+
+            std::vector<uint8_t> pattern(n, 0);
+            std::vector<float> energy(n, 0.0f);
+            auto splat = [&](int p, float sign) {
+                int px = p % size, py = p / size;
+                for (int y = 0; y < size; y++)
+                    for (int x = 0; x < size; x++)
+                        energy[y * size + x] += sign * kernel[((y - py) & (size - 1)) * size + ((x - px) & (size - 1))];
+            };
+            auto tightest_cluster = [&]() {
+                int best = -1;
+                for (int p = 0; p < n; p++)
+                    if (pattern[p] && (best < 0 || energy[p] > energy[best]))
+                        best = p;
+                return best;
+            };
+            auto largest_void = [&]() {
+                int best = -1;
+                for (int p = 0; p < n; p++)
+                    if (!pattern[p] && (best < 0 || energy[p] < energy[best]))
+                        best = p;
+                return best;
+            };
+
+            // Initial pattern: a tenth of the pixels at fixed pseudo-random places, then swap
+            // the tightest cluster into the largest void until that moves nothing.
+            int ones = n / 10;
+            for (int placed = 0, i = 0; placed < ones; i++) {
+                int p = int(mix_bits(uint64_t(i)) % n);
+                if (!pattern[p]) {
+                    pattern[p] = 1;
+                    splat(p, 1);
+                    placed++;
+                }
+            }
+            while (true) {
+                int cluster = tightest_cluster();
+                pattern[cluster] = 0;
+                splat(cluster, -1);
+                int hole = largest_void();
+                pattern[hole] = 1;
+                splat(hole, 1);
+                if (hole == cluster)
+                    break;
+            }
+
+            std::vector<int> rank(n, 0);
+            std::vector<uint8_t> initial = pattern;
+            std::vector<float> initialEnergy = energy;
+
+            // Rank the initial points by removing tightest clusters...
+            for (int r = ones - 1; r >= 0; r--) {
+                int cluster = tightest_cluster();
+                pattern[cluster] = 0;
+                splat(cluster, -1);
+                rank[cluster] = r;
+            }
+
+            // ...and the rest by filling the largest voids.
+            pattern = initial;
+            energy = initialEnergy;
+            for (int r = ones; r < n; r++) {
+                int hole = largest_void();
+                pattern[hole] = 1;
+                splat(hole, 1);
+                rank[hole] = r;
+            }
+
+            values.resize(n);
+            for (int p = 0; p < n; p++)
+                values[p] = (rank[p] + 0.5f) / n;
+        }
+};
+
+class BlueNoiseSampler : public SobolSampler {
+    // Georgiev and Fajardo, "Blue-noise Dithered Sampling" (2016): every pixel uses the same
+    // scrambled Sobol points, toroidally shifted by blue-noise values (a differently offset
+    // window of the texture per dimension), which spreads the per-pixel error as blue noise.
+    public:
+        BlueNoiseSampler(uint64_t seed) : SobolSampler(seed) { hashPixels = false; }
+
+    protected:
+        float sample_1d(int d) override { return shift(SobolSampler::sample_1d(d), d); }
+
+        Vector3 sample_2d(int d) override {
+            Vector3 uv = SobolSampler::sample_2d(d);
+            return Vector3(shift(uv.x(), d), shift(uv.y(), d + 1), 0);
+        }
+
+    private:
+        float shift(float u, int d) const {
+            // R2 sequence offsets keep the windows of consecutive dimensions apart.
+            int ox = int(BlueNoiseTexture::size * std::fmod(d * 0.7548776662f, 1.0f));
+            int oy = int(BlueNoiseTexture::size * std::fmod(d * 0.5698402910f, 1.0f));
+            float s = u + BlueNoiseTexture::instance().value(px + ox, py + oy);
+            return s >= 1 ? s - 1 : s;
+        }
+};
+
+inline std::unique_ptr<Sampler> make_sampler(SAMPLERTYPE type, uint32_t samplesPerPixel, uint64_t seed)
+{
+    switch (type) {
+    case SAMPLER_STRATIFIED:
+        return std::make_unique<StratifiedSampler>(samplesPerPixel, seed);
+    case SAMPLER_SOBOL:
+        return std::make_unique<SobolSampler>(seed);
+    case SAMPLER_HALTON:
+        return std::make_unique<HaltonSampler>(seed);
+    case SAMPLER_BLUE_NOISE:
+        return std::make_unique<BlueNoiseSampler>(seed);
+    default:
+        return std::make_unique<IndependentSampler>();
+    }
+}
+
+inline bool parse_sampler_type(const std::string& name, SAMPLERTYPE& type)
+{
+    for (int t = 0; t < SAMPLER_TYPE_COUNT; t++) {
+        if (name == samplerTypeNames[t]) {
+            type = SAMPLERTYPE(t);
+            return true;
+        }
+    }
+    std::cerr << "ERROR: Unknown sampler '" << name << "'.\n";
+    return false;
+}
+
+#endif
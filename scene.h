@@ -0,0 +1,790 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "constant_medium.h"
+#include "hittableList.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+#include "texture.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Scene description files.
+//
+// A text scene is a list of one-line directives; '#' starts a comment. Textures and materials
+// are declared by name before use, and anywhere a texture is expected `rgb r g b` may be used
+// instead of a name.
+//
+//   output cornell.ppm
+//   camera width 600                  (also: aspect, samples, depth, background r g b, fov,
+//                                      lookfrom x y z, lookat x y z, up x y z, defocus, focus)
+//   texture <name> solid r g b
+//   texture <name> checker <scale> <even> <odd>
+//   texture <name> image <file>
+//   texture <name> noise <scale>
+//   material <name> lambertian <texture>
+//   material <name> metal <texture> <fuzz>
+//   material <name> dielectric <texture> <refraction index>
+//   material <name> light <texture>
+//   material <name> isotropic <texture>
+//   sphere cx cy cz radius <material>
+//   moving_sphere x1 y1 z1 x2 y2 z2 radius <material>
+//   quad|triangle|ellipse qx qy qz ux uy uz vx vy vz <material>
+//   box ax ay az bx by bz <material>
+//   group ... end                     (the enclosed shapes are put in their own BVH)
+//
+// Any shape line, and the `end` of a group, may be followed by modifiers applied left to right:
+//   rotate x y z   translate x y z   medium <density> <texture>
+//
+// The compiled binary form stores the same records as flat arrays behind a fixed header, so it
+// is loaded with one read per array. It uses the host byte order.
+
+class Scene {
+    public:
+        Camera camera;
+        HittableList world;
+        std::string output = "scene.ppm";
+};
+
+enum SCENETEXTURETYPE : uint32_t {
+    TEXTURE_SOLID = 0,
+    TEXTURE_CHECKER,
+    TEXTURE_IMAGE,
+    TEXTURE_NOISE,
+};
+
+enum SCENEMATERIALTYPE : uint32_t {
+    MATERIAL_LAMBERTIAN = 0,
+    MATERIAL_METAL,
+    MATERIAL_DIELECTRIC,
+    MATERIAL_LIGHT,
+    MATERIAL_ISOTROPIC,
+};
+
+enum SCENESHAPETYPE : uint32_t {
+    SHAPE_SPHERE = 0,
+    SHAPE_MOVING_SPHERE,
+    SHAPE_QUAD,
+    SHAPE_TRIANGLE,
+    SHAPE_ELLIPSE,
+    SHAPE_BOX,
+    SHAPE_GROUP,
+};
+
+enum SCENEMODIFIERTYPE : uint32_t {
+    MODIFIER_ROTATE = 0,
+    MODIFIER_TRANSLATE,
+    MODIFIER_MEDIUM,
+};
+
+struct TextureRecord {
+    uint32_t type;
+    int32_t even;       // Checker sub-textures
+    int32_t odd;
+    uint32_t path;      // Image file name, as an offset into the string table
+    float color[3];
+    float scale;
+};
+
+struct MaterialRecord {
+    uint32_t type;
+    int32_t texture;
+    float param;        // Metal fuzz or dielectric refraction index
+};
+
+struct ShapeRecord {
+    uint32_t type;
+    int32_t material;
+    uint32_t end;       // One past the last shape belonging to this one (groups span their children)
+    uint32_t firstModifier;
+    uint32_t modifierCount;
+    float params[10];
+};
+
+struct ModifierRecord {
+    uint32_t type;
+    int32_t texture;
+    float params[3];
+};
+
+struct CameraRecord {
+    float aspectRatio;
+    uint32_t imageWidth;
+    uint32_t samplesPerPixel;
+    uint32_t maxDepth;
+    float background[3];
+    float fov;
+    float lookFrom[3];
+    float lookAt[3];
+    float relativeUp[3];
+    float defocusAngle;
+    float focusDist;
+};
+
+class SceneDescription {
+    public:
+        CameraRecord camera;
+        uint32_t output = 0;
+        std::vector<TextureRecord> textures;
+        std::vector<MaterialRecord> materials;
+        std::vector<ShapeRecord> shapes;
+        std::vector<ModifierRecord> modifiers;
+        std::string strings;
+
+        SceneDescription() {
+            Camera defaults;
+            camera.aspectRatio = defaults.aspectRatio;
+            camera.imageWidth = defaults.imageWidth;
+            camera.samplesPerPixel = defaults.samplesPerPixel;
+            camera.maxDepth = defaults.maxDepth;
+            store(camera.background, defaults.background);
+            camera.fov = defaults.fov;
+            store(camera.lookFrom, defaults.lookFrom);
+            store(camera.lookAt, defaults.lookAt);
+            store(camera.relativeUp, defaults.relativeUp);
+            camera.defocusAngle = defaults.defocusAngle;
+            camera.focusDist = defaults.focusDist;
+            output = add_string("scene.ppm");
+        }
+
+        uint32_t add_string(const std::string& s) {
+            uint32_t offset = uint32_t(strings.size());
+            strings += s;
+            strings += '\0';
+            return offset;
+        }
+
+        const char* string_at(uint32_t offset) const {
+            return strings.c_str() + offset;
+        }
+
+        static void store(float out[3], const Vector3& vec) {
+            out[0] = vec.x();
+            out[1] = vec.y();
+            out[2] = vec.z();
+        }
+};
+
+class SceneParser {
+    public:
+        SceneParser(SceneDescription& desc, const std::string& sourceName) : desc(desc), sourceName(sourceName) {}
+
+        bool parse(std::istream& in) {
+            std::string line;
+            while (std::getline(in, line)) {
+                lineNumber++;
+                size_t comment = line.find('#');
+                if (comment != std::string::npos)
+                    line.erase(comment);
+
+                tokens.clear();
+                next = 0;
+                std::istringstream words(line);
+                std::string word;
+                while (words >> word)
+                    tokens.push_back(word);
+
+                if (!tokens.empty() && !parse_directive())
+                    return false;
+            }
+
+            if (!openGroups.empty())
+                return error("group is missing its end");
+            return true;
+        }
+
+    private:
+        SceneDescription& desc;
+        std::string sourceName;
+        int lineNumber = 0;
+        std::vector<std::string> tokens;
+        size_t next = 0;
+        std::map<std::string, int32_t> textureNames;
+        std::map<std::string, int32_t> materialNames;
+        std::vector<uint32_t> openGroups;
+
+        bool error(const std::string& message) {
+            std::cerr << "ERROR: " << sourceName << ":" << lineNumber << ": " << message << "\n";
+            return false;
+        }
+
+        bool word(std::string& out) {
+            if (next >= tokens.size())
+                return error("unexpected end of line after '" + tokens.back() + "'");
+            out = tokens[next++];
+            return true;
+        }
+
+        bool number(float& out) {
+            std::string token;
+            if (!word(token))
+                return false;
+            char* end = nullptr;
+            out = std::strtof(token.c_str(), &end);
+            if (end == token.c_str() || *end != '\0')
+                return error("expected a number, found '" + token + "'");
+            return true;
+        }
+
+        bool numbers(float* out, int count) {
+            for (int i = 0; i < count; i++)
+                if (!number(out[i]))
+                    return false;
+            return true;
+        }
+
+        bool integer(uint32_t& out) {
+            float value;
+            if (!number(value))
+                return false;
+            if (value < 0)
+                return error("expected a non-negative value");
+            out = uint32_t(value);
+            return true;
+        }
+
+        bool texture_ref(int32_t& out) {
+            std::string name;
+            if (!word(name))
+                return false;
+
+            if (name == "rgb") {
+                TextureRecord tex = {};
+                tex.type = TEXTURE_SOLID;
+                if (!numbers(tex.color, 3))
+                    return false;
+                out = int32_t(desc.textures.size());
+                desc.textures.push_back(tex);
+                return true;
+            }
+
+            auto found = textureNames.find(name);
+            if (found == textureNames.end())
+                return error("unknown texture '" + name + "'");
+            out = found->second;
+            return true;
+        }
+
+        bool material_ref(int32_t& out) {
+            std::string name;
+            if (!word(name))
+                return false;
+            auto found = materialNames.find(name);
+            if (found == materialNames.end())
+                return error("unknown material '" + name + "'");
+            out = found->second;
+            return true;
+        }
+
+        bool parse_directive() {
+            std::string directive = tokens[next++];
+
+            if (directive == "output") {
+                std::string file;
+                if (!word(file))
+                    return false;
+                desc.output = desc.add_string(file);
+                return end_of_line();
+            }
+            if (directive == "camera")
+                return parse_camera() && end_of_line();
+            if (directive == "texture")
+                return parse_texture() && end_of_line();
+            if (directive == "material")
+                return parse_material() && end_of_line();
+            if (directive == "group") {
+                ShapeRecord group = {};
+                group.type = SHAPE_GROUP;
+                group.material = -1;
+                openGroups.push_back(uint32_t(desc.shapes.size()));
+                desc.shapes.push_back(group);
+                return end_of_line();
+            }
+            if (directive == "end") {
+                if (openGroups.empty())
+                    return error("'end' without a matching 'group'");
+                uint32_t group = openGroups.back();
+                openGroups.pop_back();
+                desc.shapes[group].end = uint32_t(desc.shapes.size());
+                return parse_modifiers(desc.shapes[group]);
+            }
+            return parse_shape(directive);
+        }
+
+        bool end_of_line() {
+            if (next < tokens.size())
+                return error("unexpected '" + tokens[next] + "'");
+            return true;
+        }
+
+        bool parse_camera() {
+            std::string key;
+            if (!word(key))
+                return false;
+
+            CameraRecord& cam = desc.camera;
+            if (key == "aspect") return number(cam.aspectRatio);
+            if (key == "width") {
+                float width;
+                if (!number(width))
+                    return false;
+                if (width < 0)
+                    return error("expected a non-negative value");
+                if (width >= 2147483648.0f)
+                    return error("width above the 2147483647 pixel limit");
+                cam.imageWidth = uint32_t(width);
+                return true;
+            }
+            if (key == "samples") return integer(cam.samplesPerPixel);
+            if (key == "depth") return integer(cam.maxDepth);
+            if (key == "background") return numbers(cam.background, 3);
+            if (key == "fov") return number(cam.fov);
+            if (key == "lookfrom") return numbers(cam.lookFrom, 3);
+            if (key == "lookat") return numbers(cam.lookAt, 3);
+            if (key == "up") return numbers(cam.relativeUp, 3);
+            if (key == "defocus") return number(cam.defocusAngle);
+            if (key == "focus") return number(cam.focusDist);
+            return error("unknown camera setting '" + key + "'");
+        }
+
+        bool parse_texture() {
+            std::string name, type;
+            if (!word(name) || !word(type))
+                return false;
+
+            TextureRecord tex = {};
+            tex.even = tex.odd = -1;
+            if (type == "solid") {
+                tex.type = TEXTURE_SOLID;
+                if (!numbers(tex.color, 3))
+                    return false;
+            }
+            else if (type == "checker") {
+                tex.type = TEXTURE_CHECKER;
+                if (!number(tex.scale) || !texture_ref(tex.even) || !texture_ref(tex.odd))
+                    return false;
+            }
+            else if (type == "image") {
+                std::string file;
+                tex.type = TEXTURE_IMAGE;
+                if (!word(file))
+                    return false;
+                tex.path = desc.add_string(file);
+            }
+            else if (type == "noise") {
+                tex.type = TEXTURE_NOISE;
+                if (!number(tex.scale))
+                    return false;
+            }
+            else {
+                return error("unknown texture type '" + type + "'");
+            }
+
+            textureNames[name] = int32_t(desc.textures.size());
+            desc.textures.push_back(tex);
+            return true;
+        }
+
+        bool parse_material() {
+            std::string name, type;
+            if (!word(name) || !word(type))
+                return false;
+
+            MaterialRecord mat = {};
+            if (type == "lambertian") mat.type = MATERIAL_LAMBERTIAN;
+            else if (type == "metal") mat.type = MATERIAL_METAL;
+            else if (type == "dielectric") mat.type = MATERIAL_DIELECTRIC;
+            else if (type == "light") mat.type = MATERIAL_LIGHT;
+            else if (type == "isotropic") mat.type = MATERIAL_ISOTROPIC;
+            else return error("unknown material type '" + type + "'");
+
+            if (!texture_ref(mat.texture))
+                return false;
+            if ((mat.type == MATERIAL_METAL || mat.type == MATERIAL_DIELECTRIC) && !number(mat.param))
+                return false;
+
+            materialNames[name] = int32_t(desc.materials.size());
+            desc.materials.push_back(mat);
+            return true;
+        }
+
+        bool parse_shape(const std::string& type) {
+            ShapeRecord shape = {};
+            int paramCount;
+
+            if (type == "sphere") { shape.type = SHAPE_SPHERE; paramCount = 4; }
+            else if (type == "moving_sphere") { shape.type = SHAPE_MOVING_SPHERE; paramCount = 7; }
+            else if (type == "quad") { shape.type = SHAPE_QUAD; paramCount = 9; }
+            else if (type == "triangle") { shape.type = SHAPE_TRIANGLE; paramCount = 9; }
+            else if (type == "ellipse") { shape.type = SHAPE_ELLIPSE; paramCount = 9; }
+            else if (type == "box") { shape.type = SHAPE_BOX; paramCount = 6; }
+            else return error("unknown directive '" + type + "'");
+
+            if (!numbers(shape.params, paramCount) || !material_ref(shape.material))
+                return false;
+
+            shape.end = uint32_t(desc.shapes.size()) + 1;
+            desc.shapes.push_back(shape);
+            return parse_modifiers(desc.shapes.back());
+        }
+
+        bool parse_modifiers(ShapeRecord& shape) {
+            shape.firstModifier = uint32_t(desc.modifiers.size());
+            while (next < tokens.size()) {
+                std::string type = tokens[next++];
+                ModifierRecord mod = {};
+                mod.texture = -1;
+
+                if (type == "rotate") {
+                    mod.type = MODIFIER_ROTATE;
+                    if (!numbers(mod.params, 3))
+                        return false;
+                }
+                else if (type == "translate") {
+                    mod.type = MODIFIER_TRANSLATE;
+                    if (!numbers(mod.params, 3))
+                        return false;
+                }
+                else if (type == "medium") {
+                    mod.type = MODIFIER_MEDIUM;
+                    if (!number(mod.params[0]) || !texture_ref(mod.texture))
+                        return false;
+                }
+                else {
+                    return error("unknown modifier '" + type + "'");
+                }
+
+                desc.modifiers.push_back(mod);
+                shape.modifierCount++;
+            }
+            return true;
+        }
+};
+
+class SceneBuilder {
+    public:
+        SceneBuilder(const SceneDescription& desc) : desc(desc) {}
+
+        void build(Scene& scene) {
+            const CameraRecord& cam = desc.camera;
+            scene.camera.aspectRatio = cam.aspectRatio;
+            scene.camera.imageWidth = cam.imageWidth;
+            scene.camera.samplesPerPixel = cam.samplesPerPixel;
+            scene.camera.maxDepth = cam.maxDepth;
+            scene.camera.background = Color(cam.background[0], cam.background[1], cam.background[2]);
+            scene.camera.fov = cam.fov;
+            scene.camera.lookFrom = Point3(cam.lookFrom[0], cam.lookFrom[1], cam.lookFrom[2]);
+            scene.camera.lookAt = Point3(cam.lookAt[0], cam.lookAt[1], cam.lookAt[2]);
+            scene.camera.relativeUp = Vector3(cam.relativeUp[0], cam.relativeUp[1], cam.relativeUp[2]);
+            scene.camera.defocusAngle = cam.defocusAngle;
+            scene.camera.focusDist = cam.focusDist;
+            scene.output = desc.string_at(desc.output);
+
+            textures.clear();
+            for (const TextureRecord& tex : desc.textures)
+                textures.push_back(build_texture(tex));
+
+            materials.clear();
+            for (const MaterialRecord& mat : desc.materials)
+                materials.push_back(build_material(mat));
+
+            scene.world.clear();
+            build_shapes(0, uint32_t(desc.shapes.size()), scene.world);
+        }
+
+    private:
+        const SceneDescription& desc;
+        std::vector<shared_ptr<Texture>> textures;
+        std::vector<shared_ptr<Material>> materials;
+
+        shared_ptr<Texture> build_texture(const TextureRecord& tex) const {
+            switch (tex.type) {
+            case TEXTURE_CHECKER:
+                return make_shared<CheckerTexture>(tex.scale, textures[tex.even], textures[tex.odd]);
+            case TEXTURE_IMAGE:
+                return make_shared<ImageTexture>(desc.string_at(tex.path));
+            case TEXTURE_NOISE:
+                return make_shared<NoiseTexture>(tex.scale);
+            default:
+                return make_shared<SolidColor>(tex.color[0], tex.color[1], tex.color[2]);
+            }
+        }
+
+        shared_ptr<Material> build_material(const MaterialRecord& mat) const {
+            shared_ptr<Texture> tex = textures[mat.texture];
+            switch (mat.type) {
+            case MATERIAL_METAL:
+                return make_shared<Metal>(tex, mat.param);
+            case MATERIAL_DIELECTRIC:
+                return make_shared<Dielectric>(tex, mat.param);
+            case MATERIAL_LIGHT:
+                return make_shared<DiffuseLight>(tex);
+            case MATERIAL_ISOTROPIC:
+                return make_shared<Isotropic>(tex);
+            default:
+                return make_shared<Lambertian>(tex);
+            }
+        }
+
+        void build_shapes(uint32_t begin, uint32_t end, HittableList& list) const {
+            for (uint32_t i = begin; i < end; i = desc.shapes[i].end) {
+                const ShapeRecord& shape = desc.shapes[i];
+                shared_ptr<Hittable> object = build_shape(i);
+                if (!object)
+                    continue;
+
+                for (uint32_t m = 0; m < shape.modifierCount; m++)
+                    object = apply_modifier(desc.modifiers[shape.firstModifier + m], object);
+                list.add(object);
+            }
+        }
+
+        shared_ptr<Hittable> build_shape(uint32_t index) const {
+            const ShapeRecord& shape = desc.shapes[index];
+            const float* p = shape.params;
+            shared_ptr<Material> mat = shape.material >= 0 ? materials[shape.material] : nullptr;
+
+            switch (shape.type) {
+            case SHAPE_SPHERE:
+                return make_shared<Sphere>(Point3(p[0], p[1], p[2]), p[3], mat);
+            case SHAPE_MOVING_SPHERE:
+                return make_shared<Sphere>(Point3(p[0], p[1], p[2]), Point3(p[3], p[4], p[5]), p[6], mat);
+            case SHAPE_QUAD:
+                return make_shared<Quad>(Point3(p[0], p[1], p[2]), Vector3(p[3], p[4], p[5]), Vector3(p[6], p[7], p[8]), mat);
+            case SHAPE_TRIANGLE:
+                return make_shared<Triangle>(Point3(p[0], p[1], p[2]), Vector3(p[3], p[4], p[5]), Vector3(p[6], p[7], p[8]), mat);
+            case SHAPE_ELLIPSE:
+                return make_shared<Ellipse>(Point3(p[0], p[1], p[2]), Vector3(p[3], p[4], p[5]), Vector3(p[6], p[7], p[8]), mat);
+            case SHAPE_BOX:
+                return Box(Point3(p[0], p[1], p[2]), Point3(p[3], p[4], p[5]), mat);
+            case SHAPE_GROUP: {
+                HittableList children;
+                build_shapes(index + 1, shape.end, children);
+                if (children.objs.empty())
+                    return nullptr;
+                return make_shared<BVHNode>(children);
+            }
+            default:
+                return nullptr;
+            }
+        }
+
+        shared_ptr<Hittable> apply_modifier(const ModifierRecord& mod, shared_ptr<Hittable> object) const {
+            const float* p = mod.params;
+            switch (mod.type) {
+            case MODIFIER_ROTATE:
+                return rotate(object, p[0], p[1], p[2]);
+            case MODIFIER_TRANSLATE:
+                return make_shared<Translate>(object, Vector3(p[0], p[1], p[2]));
+            default:
+                return make_shared<ConstantMedium>(object, p[0], textures[mod.texture]);
+            }
+        }
+};
+
+// Binary scene file
+
+struct SceneFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t textureCount;
+    uint32_t materialCount;
+    uint32_t shapeCount;
+    uint32_t modifierCount;
+    uint32_t stringBytes;
+    uint32_t output;
+    CameraRecord camera;
+};
+
+static const char sceneFileMagic[4] = { 'R', 'T', 'S', 'B' };
+static const uint32_t sceneFileVersion = 1;
+
+inline bool save_scene_binary(std::ostream& ofs, const SceneDescription& desc)
+{
+    TRACE_SCOPE("save scene binary", "scene");
+    SceneFileHeader header = {};
+    std::memcpy(header.magic, sceneFileMagic, sizeof(header.magic));
+    header.version = sceneFileVersion;
+    header.textureCount = uint32_t(desc.textures.size());
+    header.materialCount = uint32_t(desc.materials.size());
+    header.shapeCount = uint32_t(desc.shapes.size());
+    header.modifierCount = uint32_t(desc.modifiers.size());
+    header.stringBytes = uint32_t(desc.strings.size());
+    header.output = desc.output;
+    header.camera = desc.camera;
+
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(desc.textures.data()), desc.textures.size() * sizeof(TextureRecord));
+    ofs.write(reinterpret_cast<const char*>(desc.materials.data()), desc.materials.size() * sizeof(MaterialRecord));
+    ofs.write(reinterpret_cast<const char*>(desc.shapes.data()), desc.shapes.size() * sizeof(ShapeRecord));
+    ofs.write(reinterpret_cast<const char*>(desc.modifiers.data()), desc.modifiers.size() * sizeof(ModifierRecord));
+    ofs.write(desc.strings.data(), desc.strings.size());
+    return bool(ofs);
+}
+
+inline bool save_scene_binary(const std::string& filename, const SceneDescription& desc)
+{
+    std::ofstream ofs(filename, std::ios::binary);
+    if (!ofs) {
+        std::cerr << "ERROR: Could not write scene file '" << filename << "'.\n";
+        return false;
+    }
+    return save_scene_binary(ofs, desc);
+}
+
+inline bool is_scene_binary(const std::string& filename)
+{
+    std::ifstream ifs(filename, std::ios::binary);
+    char magic[4] = {};
+    ifs.read(magic, sizeof(magic));
+    return ifs && std::memcmp(magic, sceneFileMagic, sizeof(magic)) == 0;
+}
+
+inline std::string check_scene_description(const SceneDescription& desc)
+{
+    // Returns what is wrong with a description read from a file, or "" if every index, shape
+    // range and string offset in it lies within its table, so SceneBuilder can trust it.
+    auto in = [](int64_t index, size_t count) { return index >= 0 && uint64_t(index) < count; };
+    if (!in(desc.output, desc.strings.size()))
+        return "output name out of range";
+    if (!desc.strings.empty() && desc.strings.back() != '\0')
+        return "unterminated string table";
+    for (size_t t = 0; t < desc.textures.size(); t++) {
+        const TextureRecord& tex = desc.textures[t];
+        // Checkers refer to textures built before them.
+        if (tex.type == TEXTURE_CHECKER && (!in(tex.even, t) || !in(tex.odd, t)))
+            return "texture " + std::to_string(t) + " refers to a missing texture";
+        if (tex.type == TEXTURE_IMAGE && !in(tex.path, desc.strings.size()))
+            return "texture " + std::to_string(t) + " has its path out of range";
+    }
+    for (size_t m = 0; m < desc.materials.size(); m++)
+        if (!in(desc.materials[m].texture, desc.textures.size()))
+            return "material " + std::to_string(m) + " refers to a missing texture";
+    for (size_t i = 0; i < desc.shapes.size(); i++) {
+        const ShapeRecord& shape = desc.shapes[i];
+        // Only groups go without a material (a negative index).
+        if (!in(shape.material, desc.materials.size()) && (shape.type != SHAPE_GROUP || shape.material >= 0))
+            return "shape " + std::to_string(i) + " refers to a missing material";
+        if (shape.end <= i || shape.end > desc.shapes.size())
+            return "shape " + std::to_string(i) + " has its end out of range";
+        if (uint64_t(shape.firstModifier) + shape.modifierCount > desc.modifiers.size())
+            return "shape " + std::to_string(i) + " has its modifiers out of range";
+    }
+    for (size_t m = 0; m < desc.modifiers.size(); m++) {
+        const ModifierRecord& mod = desc.modifiers[m];
+        if (mod.type != MODIFIER_ROTATE && mod.type != MODIFIER_TRANSLATE && !in(mod.texture, desc.textures.size()))
+            return "modifier " + std::to_string(m) + " refers to a missing texture";
+    }
+    return "";
+}
+
+inline bool load_scene_binary(const std::string& filename, SceneDescription& desc)
+{
+    TRACE_SCOPE("load scene binary", "scene");
+    std::ifstream ifs(filename, std::ios::binary);
+    SceneFileHeader header;
+    if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, sceneFileMagic, sizeof(header.magic)) != 0 ||
+        header.version != sceneFileVersion) {
+        std::cerr << "ERROR: '" << filename << "' is not a compatible binary scene file.\n";
+        return false;
+    }
+
+    desc.camera = header.camera;
+    desc.output = header.output;
+    desc.textures.resize(header.textureCount);
+    desc.materials.resize(header.materialCount);
+    desc.shapes.resize(header.shapeCount);
+    desc.modifiers.resize(header.modifierCount);
+    desc.strings.resize(header.stringBytes);
+
+    ifs.read(reinterpret_cast<char*>(desc.textures.data()), desc.textures.size() * sizeof(TextureRecord));
+    ifs.read(reinterpret_cast<char*>(desc.materials.data()), desc.materials.size() * sizeof(MaterialRecord));
+    ifs.read(reinterpret_cast<char*>(desc.shapes.data()), desc.shapes.size() * sizeof(ShapeRecord));
+    ifs.read(reinterpret_cast<char*>(desc.modifiers.data()), desc.modifiers.size() * sizeof(ModifierRecord));
+    ifs.read(&desc.strings[0], desc.strings.size());
+
+    if (!ifs) {
+        std::cerr << "ERROR: Binary scene file '" << filename << "' is truncated.\n";
+        return false;
+    }
+    std::string problem = check_scene_description(desc);
+    if (!problem.empty()) {
+        std::cerr << "ERROR: Binary scene file '" << filename << "' is corrupt: " << problem << ".\n";
+        return false;
+    }
+    return true;
+}
+
+inline bool load_scene_text(const std::string& filename, SceneDescription& desc)
+{
+    TRACE_SCOPE("parse scene", "scene");
+    std::ifstream ifs(filename);
+    if (!ifs) {
+        std::cerr << "ERROR: Could not open scene file '" << filename << "'.\n";
+        return false;
+    }
+    return SceneParser(desc, filename).parse(ifs);
+}
+
+inline bool load_scene(const std::string& filename, Scene& scene, bool writeCache = true)
+{
+    // Loads a text or binary scene. A text scene is compiled to a binary cache next to it
+    // (filename + ".bin"), which later loads use for as long as it is newer than the text.
+    // Without writeCache an existing cache is still used, but none is written.
+    TRACE_SCOPE("load scene", "scene");
+    SceneDescription desc;
+
+    if (is_scene_binary(filename)) {
+        if (!load_scene_binary(filename, desc))
+            return false;
+    }
+    else {
+        namespace fs = std::filesystem;
+        std::string cache = filename + ".bin";
+        std::error_code cacheError, textError;
+        bool cacheFresh = false;
+        if (fs::exists(cache, cacheError)) {
+            auto cacheTime = fs::last_write_time(cache, cacheError);
+            auto textTime = fs::last_write_time(filename, textError);
+            cacheFresh = !cacheError && !textError && cacheTime >= textTime;
+        }
+
+        if (!cacheFresh || !load_scene_binary(cache, desc)) {
+            desc = SceneDescription();
+            if (!load_scene_text(filename, desc))
+                return false;
+            if (writeCache) {
+                // The scene loads without its cache, only more slowly next time.
+                std::ofstream ofs(cache, std::ios::binary);
+                bool opened = bool(ofs);
+                if (!opened || !save_scene_binary(ofs, desc)) {
+                    std::clog << "WARNING: Could not write scene cache '" << cache << "'.\n";
+                    if (opened) {
+                        ofs.close();
+                        fs::remove(cache, cacheError);     // Not a partial cache
+                    }
+                }
+            }
+        }
+    }
+
+    TRACE_SCOPE("build scene", "scene");
+    SceneBuilder(desc).build(scene);
+    return true;
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "hittableList.h"
 #include "common.h"
 
 class Sphere : public Hittable
@@ -29,8 +30,18 @@ public:
 
     AABB bounding_box() const override { return bbox; }
 
+    AABB bounding_box_at(float time) const override
+    {
+        if (!isMoving)
+            return bbox;
+        Vector3 radVec = Vector3(rad, rad, rad);
+        Point3 cen = sphere_center(time);
+        return AABB(cen - radVec, cen + radVec);
+    }
+
     bool hit(const Ray& r, Interval rayT, HitRecord& rec) const override
     {
+        STAT_INC(STAT_TEST_SPHERE);
         Point3 cen = isMoving ? sphere_center(r.time()) : cen1;
         Vector3 oc = cen - r.origin();
         float a = r.direction().length_squared();
@@ -57,9 +68,41 @@ public:
         rec.normal = (rec.p - cen) / rad;
         Vector3 outwardNormal = (rec.p - cen) / rad;
         rec.set_face_normal(r, outwardNormal);
-        get_sphere_uv(outwardNormal, rec.u, rec.v);
+        get_sphere_uv(oriented ? uvFrame.inverse_vector(outwardNormal) : outwardNormal, rec.u, rec.v);
         rec.mat = mat;
+        rec.objectId = objectId;
+
+        return true;
+    }
 
+    bool occluded(const Ray& r, Interval rayT) const override
+    {
+        STAT_INC(STAT_TEST_SPHERE);
+        Point3 cen = isMoving ? sphere_center(r.time()) : cen1;
+        Vector3 oc = cen - r.origin();
+        float a = r.direction().length_squared();
+        float h = dot(r.direction(), oc);
+        float c = oc.length_squared() - rad * rad;
+
+        float discriminant = h * h - a * c;
+        if (discriminant < 0)
+            return false;
+
+        float sqrtd = std::sqrt(discriminant);
+        return rayT.surrounds((h - sqrtd) / a) || rayT.surrounds((h + sqrtd) / a);
+    }
+
+    bool bake(const Transform& xf, HittableList& out) const override
+    {
+        shared_ptr<Sphere> baked = isMoving
+            ? make_shared<Sphere>(xf.point(cen1), xf.point(cen1 + centerVec), rad, mat)
+            : make_shared<Sphere>(xf.point(cen1), rad, mat);
+        // A rotated sphere keeps its texture orientation by mapping normals back for the UVs.
+        baked->uvFrame = xf * uvFrame;
+        baked->uvFrame.offset = Vector3();
+        baked->oriented = !baked->uvFrame.is_translation();
+        baked->objectId = objectId;
+        out.add(baked);
         return true;
     }
 
@@ -70,6 +113,8 @@ private:
     bool isMoving;
     Vector3 centerVec;
     AABB bbox;
+    Transform uvFrame;      // Rotation of a baked sphere's texture, applied only if oriented
+    bool oriented = false;
 
     Point3 sphere_center(float time) const {
         // Linearly interpolate from center1 to center2 according to time, where t=0 yields
@@ -0,0 +1,182 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Render statistics.
+//
+// Each thread counts into its own plain block of integers, so an increment is a single add to
+// thread-local memory with no atomics. Threads register their block the first time they render;
+// collect_stats() sums every registered block (plus blocks of threads that have exited).
+// Defining RT_DISABLE_STATS compiles every STAT_* macro away.
+
+enum STATCOUNTER {
+    STAT_CAMERA_RAYS = 0,
+    STAT_SECONDARY_RAYS,
+    STAT_RAY_HITS,
+    STAT_BVH_NODES,
+    STAT_TEST_SPHERE,
+    STAT_TEST_QUAD,
+    STAT_TEST_TRIANGLE,
+    STAT_TEST_ELLIPSE,
+    STAT_TEST_MEDIUM,
+    STAT_TEST_BOX,
+    STAT_OCCLUDER_CACHE_HITS,   // occluded() queries answered by the thread's last occluder
+    STAT_TERMINATE_MISS,        // Escaped to the background
+    STAT_TERMINATE_EMITTER,     // Ended on a light that does not scatter
+    STAT_TERMINATE_ABSORBED,    // Material did not scatter (e.g. metal reflecting below the surface)
+    STAT_TERMINATE_DEPTH,       // Reached maxDepth
+    STAT_COUNT,
+};
+
+static const char* const statCounterNames[STAT_COUNT] = {
+    "camera_rays",
+    "secondary_rays",
+    "ray_hits",
+    "bvh_nodes_visited",
+    "tests_sphere",
+    "tests_quad",
+    "tests_triangle",
+    "tests_ellipse",
+    "tests_medium",
+    "tests_box",
+    "occluder_cache_hits",
+    "terminated_miss",
+    "terminated_emitter",
+    "terminated_absorbed",
+    "terminated_depth",
+};
+
+class RenderStats {
+    public:
+        // Path lengths in ray segments; the last bin collects everything longer.
+        static const int pathLengthBins = 65;
+
+        uint64_t counters[STAT_COUNT];
+        uint64_t pathLength[pathLengthBins];
+
+        void add(const RenderStats& other) {
+            for (int c = 0; c < STAT_COUNT; c++)
+                counters[c] += other.counters[c];
+            for (int b = 0; b < pathLengthBins; b++)
+                pathLength[b] += other.pathLength[b];
+        }
+
+        void write_json(std::ostream& out, double seconds, double denoiseSeconds = 0) const {
+            uint64_t rays = counters[STAT_CAMERA_RAYS] + counters[STAT_SECONDARY_RAYS];
+            out << "{\n  \"render_seconds\": " << seconds << ",\n"
+                << "  \"denoise_seconds\": " << denoiseSeconds << ",\n"
+                << "  \"rays_per_second\": " << (seconds > 0 ? rays / seconds : 0) << ",\n"
+                << "  \"counters\": {\n";
+            for (int c = 0; c < STAT_COUNT; c++)
+                out << "    \"" << statCounterNames[c] << "\": " << counters[c] << (c + 1 < STAT_COUNT ? "," : "") << "\n";
+            out << "  },\n  \"path_length_histogram\": [";
+
+            int last = pathLengthBins - 1;
+            while (last > 0 && pathLength[last] == 0)
+                last--;
+            for (int b = 0; b <= last; b++)
+                out << (b ? ", " : "") << pathLength[b];
+            out << "]\n}\n";
+        }
+};
+
+inline thread_local RenderStats threadStats = {};
+
+class StatsRegistry {
+    public:
+        static StatsRegistry& instance() {
+            static StatsRegistry registry;
+            return registry;
+        }
+
+        void add_thread(RenderStats* stats) {
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.push_back(stats);
+        }
+
+        void remove_thread(RenderStats* stats) {
+            std::lock_guard<std::mutex> lock(mutex);
+            retired.add(*stats);
+            for (size_t i = 0; i < threads.size(); i++) {
+                if (threads[i] == stats) {
+                    threads.erase(threads.begin() + i);
+                    break;
+                }
+            }
+        }
+
+        RenderStats collect() {
+            std::lock_guard<std::mutex> lock(mutex);
+            RenderStats total = retired;
+            for (RenderStats* stats : threads)
+                total.add(*stats);
+            return total;
+        }
+
+        void reset() {
+            // Only call while no thread is rendering.
+            std::lock_guard<std::mutex> lock(mutex);
+            retired = RenderStats();
+            for (RenderStats* stats : threads)
+                *stats = RenderStats();
+        }
+
+    private:
+        std::mutex mutex;
+        std::vector<RenderStats*> threads;
+        RenderStats retired = {};
+};
+
+class StatsRegistration {
+    // Owned per thread; registers the thread's counters and folds them into the retired totals
+    // when the thread exits.
+    public:
+        StatsRegistration() { StatsRegistry::instance().add_thread(&threadStats); }
+        ~StatsRegistration() { StatsRegistry::instance().remove_thread(&threadStats); }
+};
+
+inline void register_thread_stats()
+{
+#ifndef RT_DISABLE_STATS
+    static thread_local StatsRegistration registration;
+    (void)registration;
+#endif
+}
+
+inline void reset_stats()
+{
+#ifndef RT_DISABLE_STATS
+    register_thread_stats();
+    StatsRegistry::instance().reset();
+#endif
+}
+
+inline RenderStats collect_stats()
+{
+    return StatsRegistry::instance().collect();
+}
+
+inline bool write_stats_json(const std::string& filename, double seconds, double denoiseSeconds = 0)
+{
+    std::ofstream ofs(filename);
+    if (!ofs)
+        return false;
+    collect_stats().write_json(ofs, seconds, denoiseSeconds);
+    return bool(ofs);
+}
+
+#ifndef RT_DISABLE_STATS
+#define STAT_INC(counter) (threadStats.counters[counter]++)
+#define STAT_PATH_LENGTH(segments) \
+    (threadStats.pathLength[(segments) < RenderStats::pathLengthBins ? (segments) : RenderStats::pathLengthBins - 1]++)
+#else
+#define STAT_INC(counter) ((void)0)
+#define STAT_PATH_LENGTH(segments) ((void)0)
+#endif
+
+#endif
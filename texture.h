@@ -75,13 +75,24 @@ class ImageTexture : public Texture {
 class NoiseTexture : public Texture {
     public:
     NoiseTexture(float scale): scale(scale) {}
-    
+
+    // Bakes the noise over the world-space bounds into a resolution^3 grid. Points inside the
+    // bounds are looked up from the grid, points outside fall back to evaluating the noise.
+    NoiseTexture(float scale, const AABB& bakeBounds, int resolution) : scale(scale) {
+        AABB noiseBounds(Point3(scale * bakeBounds.x.min, scale * bakeBounds.y.min, scale * bakeBounds.z.min),
+                         Point3(scale * bakeBounds.x.max, scale * bakeBounds.y.max, scale * bakeBounds.z.max));
+        volume = make_shared<NoiseVolume>(noise, noiseBounds, resolution);
+    }
+
     Color value([[maybe_unused]]float u, [[maybe_unused]]float v, const Point3& p) const override {
-        return Color(1,1,1) * 0.5 * (1.0 + noise.noise(scale * p));
+        Point3 q = scale * p;
+        float n = (volume && volume->contains(q)) ? volume->noise(q) : noise.noise(q);
+        return Color(1,1,1) * 0.5 * (1.0 + n);
     }
     private:
     float scale;
     Perlin noise;
+    shared_ptr<NoiseVolume> volume;
 };
 
 #endif
\ No newline at end of file
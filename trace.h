@@ -0,0 +1,176 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Timeline tracing in the Chrome trace-event format (load the JSON in chrome://tracing or
+// Perfetto).
+//
+// TRACE_SCOPE(name, category) records one complete event covering the enclosing scope. Events
+// go to a per-thread buffer, so recording takes no lock. While tracing is stopped a scope costs
+// one relaxed atomic load; defining RT_DISABLE_TRACE removes the scopes entirely. Scopes are
+// meant for phases, tiles and threads, never for per-ray work. Names and categories must be
+// string literals.
+
+class TraceEvent {
+    public:
+        const char* name;
+        const char* category;
+        int64_t startNs;
+        int64_t durationNs;
+        const char* argNames[2];
+        int64_t argValues[2];
+};
+
+class TraceBuffer {
+    public:
+        uint32_t threadId;
+        std::string threadName;
+        std::vector<TraceEvent> events;
+};
+
+class TraceRecorder {
+    public:
+        static TraceRecorder& instance() {
+            static TraceRecorder recorder;
+            return recorder;
+        }
+
+        bool enabled() const { return active.load(std::memory_order_relaxed); }
+
+        void start() {
+            // Clears previously recorded events. Only call while no other thread is tracing.
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& buffer : buffers)
+                buffer->events.clear();
+            origin = std::chrono::steady_clock::now();
+            active.store(true, std::memory_order_relaxed);
+        }
+
+        void stop() { active.store(false, std::memory_order_relaxed); }
+
+        int64_t now_ns() const {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+        }
+
+        TraceBuffer& thread_buffer() {
+            // Buffers are owned by the recorder, so events of threads that have exited are kept.
+            static thread_local TraceBuffer* buffer = nullptr;
+            if (!buffer) {
+                std::lock_guard<std::mutex> lock(mutex);
+                buffers.push_back(std::make_unique<TraceBuffer>());
+                buffer = buffers.back().get();
+                buffer->threadId = uint32_t(buffers.size());
+            }
+            return *buffer;
+        }
+
+        bool write(const std::string& filename) {
+            std::ofstream ofs(filename);
+            if (!ofs) {
+                std::cerr << "ERROR: Could not write trace file '" << filename << "'.\n";
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ofs << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+            bool first = true;
+            for (const auto& buffer : buffers) {
+                if (buffer->events.empty())
+                    continue;
+                if (!buffer->threadName.empty()) {
+                    ofs << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+                        << buffer->threadId << ", \"args\": {\"name\": \"" << buffer->threadName << "\"}}";
+                    first = false;
+                }
+                for (const TraceEvent& e : buffer->events) {
+                    ofs << (first ? "" : ",\n") << "{\"name\": \"" << e.name << "\", \"cat\": \"" << e.category
+                        << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->threadId
+                        << ", \"ts\": " << e.startNs / 1e3 << ", \"dur\": " << e.durationNs / 1e3;
+                    if (e.argNames[0]) {
+                        ofs << ", \"args\": {\"" << e.argNames[0] << "\": " << e.argValues[0];
+                        if (e.argNames[1])
+                            ofs << ", \"" << e.argNames[1] << "\": " << e.argValues[1];
+                        ofs << "}";
+                    }
+                    ofs << "}";
+                    first = false;
+                }
+            }
+            ofs << "\n]}\n";
+            return bool(ofs);
+        }
+
+    private:
+        std::atomic<bool> active{false};
+        std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+        std::mutex mutex;
+        std::vector<std::unique_ptr<TraceBuffer>> buffers;
+};
+
+class ScopedTrace {
+    public:
+        ScopedTrace(const char* name, const char* category) {
+            TraceRecorder& recorder = TraceRecorder::instance();
+            if (!recorder.enabled())
+                return;
+            event.name = name;
+            event.category = category;
+            event.startNs = recorder.now_ns();
+            recording = true;
+        }
+
+        ScopedTrace(const char* name, const char* category, const char* arg0, int64_t value0,
+                    const char* arg1 = nullptr, int64_t value1 = 0) : ScopedTrace(name, category) {
+            event.argNames[0] = arg0;
+            event.argValues[0] = value0;
+            event.argNames[1] = arg1;
+            event.argValues[1] = value1;
+        }
+
+        ~ScopedTrace() {
+            if (!recording)
+                return;
+            TraceRecorder& recorder = TraceRecorder::instance();
+            event.durationNs = recorder.now_ns() - event.startNs;
+            recorder.thread_buffer().events.push_back(event);
+        }
+
+        ScopedTrace(const ScopedTrace&) = delete;
+        ScopedTrace& operator=(const ScopedTrace&) = delete;
+
+    private:
+        TraceEvent event = {};
+        bool recording = false;
+};
+
+inline void trace_start() { TraceRecorder::instance().start(); }
+inline void trace_stop() { TraceRecorder::instance().stop(); }
+inline bool write_trace(const std::string& filename) { return TraceRecorder::instance().write(filename); }
+
+inline void trace_thread_name(const std::string& name)
+{
+    // Labels the calling thread's row in the trace viewer.
+    TraceRecorder& recorder = TraceRecorder::instance();
+    if (recorder.enabled())
+        recorder.thread_buffer().threadName = name;
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifndef RT_DISABLE_TRACE
+#define TRACE_SCOPE(...) ScopedTrace TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
+#else
+#define TRACE_SCOPE(...) ((void)0)
+#endif
+
+#endif
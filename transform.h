@@ -0,0 +1,98 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "common.h"
+
+#include "aabb.h"
+#include "point3.h"
+
+class Transform {
+    // A rigid object-to-world transform: a rotation, then an offset. Translate and RotateX/Y/Z
+    // each apply one of these to the ray at every intersection; a chain of them composes into a
+    // single Transform that baked primitives apply once, when they are built.
+    public:
+        Vector3 axisX = Vector3(1, 0, 0);   // Images of the object's unit axes
+        Vector3 axisY = Vector3(0, 1, 0);
+        Vector3 axisZ = Vector3(0, 0, 1);
+        Vector3 offset;
+
+        static Transform translation(const Vector3& offset) {
+            Transform xf;
+            xf.offset = offset;
+            return xf;
+        }
+
+        // The rotations of RotateX/Y/Z, from their precomputed sine and cosine.
+        static Transform rotation_x(float sinTheta, float cosTheta) {
+            Transform xf;
+            xf.axisY = Vector3(0, cosTheta, sinTheta);
+            xf.axisZ = Vector3(0, -sinTheta, cosTheta);
+            return xf;
+        }
+
+        static Transform rotation_y(float sinTheta, float cosTheta) {
+            Transform xf;
+            xf.axisX = Vector3(cosTheta, 0, -sinTheta);
+            xf.axisZ = Vector3(sinTheta, 0, cosTheta);
+            return xf;
+        }
+
+        static Transform rotation_z(float sinTheta, float cosTheta) {
+            Transform xf;
+            xf.axisX = Vector3(cosTheta, sinTheta, 0);
+            xf.axisY = Vector3(-sinTheta, cosTheta, 0);
+            return xf;
+        }
+
+        Vector3 vector(const Vector3& v) const {
+            return v.x()*axisX + v.y()*axisY + v.z()*axisZ;
+        }
+
+        Point3 point(const Point3& p) const {
+            return vector(p) + offset;
+        }
+
+        Vector3 inverse_vector(const Vector3& v) const {
+            // The rotation is orthonormal, so its inverse is its transpose.
+            return Vector3(dot(axisX, v), dot(axisY, v), dot(axisZ, v));
+        }
+
+        Point3 inverse_point(const Point3& p) const {
+            return inverse_vector(p - offset);
+        }
+
+        // The axis-aligned box around `box` once transformed, from its eight corners.
+        AABB bounds(const AABB& box) const {
+            Point3 min( infinity,  infinity,  infinity);
+            Point3 max(-infinity, -infinity, -infinity);
+            for (int corner = 0; corner < 8; corner++) {
+                Point3 p = point(Point3((corner & 1) ? box.x.max : box.x.min,
+                                        (corner & 2) ? box.y.max : box.y.min,
+                                        (corner & 4) ? box.z.max : box.z.min));
+                for (int c = 0; c < 3; c++) {
+                    min[c] = std::fmin(min[c], p[c]);
+                    max[c] = std::fmax(max[c], p[c]);
+                }
+            }
+            return AABB(min, max);
+        }
+
+        bool is_translation() const {
+            return axisX.x() == 1 && axisX.y() == 0 && axisX.z() == 0 &&
+                   axisY.x() == 0 && axisY.y() == 1 && axisY.z() == 0 &&
+                   axisZ.x() == 0 && axisZ.y() == 0 && axisZ.z() == 1;
+        }
+
+        // (a * b) applies b, then a: a wrapper's transform is composed on the right of its
+        // parent's.
+        friend Transform operator*(const Transform& a, const Transform& b) {
+            Transform xf;
+            xf.axisX = a.vector(b.axisX);
+            xf.axisY = a.vector(b.axisY);
+            xf.axisZ = a.vector(b.axisZ);
+            xf.offset = a.point(b.offset);
+            return xf;
+        }
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "common.h"
+
+#include "aov.h"
+#include "hittable.h"
+#include "material.h"
+
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+// Queues for the wavefront integrator (Laine et al., "Megakernels Considered Harmful").
+//
+// Instead of following one path to its end before starting the next, a batch of camera rays
+// advances one bounce at a time: every live path is intersected, the hits are sorted so that
+// each material class (and within it each material, and so each texture) is shaded in one
+// run, and the paths that scatter are compacted into the queue for the next bounce. Shading
+// code and texture data stay hot in the caches for a whole run instead of being evicted by
+// whatever material the previous path happened to hit.
+
+class WavefrontPath {
+    public:
+        Ray ray;
+        Color throughput;
+        Color radiance;
+        AOVSample aov;
+        int x;
+        int y;
+        uint32_t sampleIndex;
+};
+
+class WavefrontQueues {
+    // Per-thread storage, reused from batch to batch.
+    public:
+        std::vector<WavefrontPath> paths;
+        std::vector<HitRecord> hits;            // By path
+        std::vector<uint32_t> active;           // Paths to extend this bounce
+        std::vector<uint32_t> next;             // Paths that scattered, for the next bounce
+        std::vector<uint8_t> primaryHit;        // Camera-ray results from packet tracing
+
+        void start_batch(size_t count) {
+            paths.resize(count);
+            hits.resize(count);
+            active.clear();
+            next.clear();
+            shadeOrder.clear();
+        }
+
+        void queue_hit(uint32_t path) {
+            const Material* mat = hits[path].mat.get();
+            if (mat != lastMaterial) {
+                lastMaterial = mat;
+                lastKey = uint32_t(class_slot(typeid(*mat).hash_code())) << 24 | (mat->materialId & 0xffffff);
+            }
+            shadeOrder.push_back(uint64_t(lastKey) << 32 | path);
+        }
+
+        const std::vector<uint32_t>& sorted_hits() {
+            // Paths queued since the last call, grouped by material class, then material, in
+            // queue order within a material. An LSD radix sort on the 32-bit key keeps this
+            // linear; a comparison sort here costs more than the grouping saves.
+            sortScratch.resize(shadeOrder.size());
+            for (int shift = 32; shift < 64; shift += 8) {
+                size_t counts[257] = {};
+                for (uint64_t item : shadeOrder)
+                    counts[((item >> shift) & 0xff) + 1]++;
+                if (counts[((shadeOrder.empty() ? 0 : shadeOrder[0] >> shift) & 0xff) + 1] == shadeOrder.size())
+                    continue;   // Every key has the same digit
+                for (int d = 0; d < 256; d++)
+                    counts[d + 1] += counts[d];
+                for (uint64_t item : shadeOrder)
+                    sortScratch[counts[(item >> shift) & 0xff]++] = item;
+                shadeOrder.swap(sortScratch);
+            }
+
+            sortedPaths.clear();
+            for (uint64_t item : shadeOrder)
+                sortedPaths.push_back(uint32_t(item));
+            shadeOrder.clear();
+            return sortedPaths;
+        }
+
+    private:
+        std::vector<uint64_t> shadeOrder;       // Shading key << 32 | path
+        std::vector<uint64_t> sortScratch;
+        std::vector<uint32_t> sortedPaths;
+        std::vector<size_t> materialClasses;    // typeid hashes, by class slot
+        const Material* lastMaterial = nullptr;
+        uint32_t lastKey = 0;
+
+        size_t class_slot(size_t typeHash) {
+            for (size_t c = 0; c < materialClasses.size(); c++)
+                if (materialClasses[c] == typeHash)
+                    return c;
+            materialClasses.push_back(typeHash);
+            return (materialClasses.size() - 1) & 0xff;
+        }
+};
+
+#endif